@@ -35,44 +35,250 @@
 
 /* Intel 8080 emulator for the Transam Triton
  * All operands implemented except IN, OUT and HLT [these now added (PBW)]
- * Also handles memory mapping
+ * Also handles memory mapping -- now through a table of pages
  * Uses the conventions described at Emulator101 (http://www.emulator101.com)
  * This code is supposed to be easy to understand rather than efficient!
  * Interrupts are handled elsewhere -- hardware interrupts now emulated (PBW)
  * Machine reset added (PBW)
+ * Op codes are dispatched through a table of handlers, one per op code,
+ * generated from templates on the register and condition fields, and
+ * the sign, zero, parity and auxiliary carry flags are looked up in
+ * tables computed at compile time, only when they are needed
+ * Optionally straight-line code is pre-decoded into cached basic blocks
  */
 
 #include <iostream>
+#include <array>
+#include <utility>
 #include "8080.hpp"
 
-extern uint16_t mem_top; // should be defined in triton.cpp
+// Memory is accessed through the page table in the bus, which takes
+// care of the ROM, VDU memory and the top of RAM (see 8080.hpp).  A
+// write to cached code throws away the blocks decoded from it.
 
-// Make sure we only write into user addressable RAM between VDU which
-// starts at 0x1000 and mem_top.  Similarly an attempt to read from
-// VDU memory (0x1000 to 0x13ff) should result in 0xff.
+#define MEM_WRITE(address, byte) BusWrite8080(state, bus, (uint16_t)(address), (uint8_t)(byte))
 
-// Note the apparently excessive use of brackets in MEM_READ is
-// because we sometimes want to bitwise negate the result ~MEM_READ in
-// handling the op codes below.
-
-#define MEM_WRITE(address, byte) { uint16_t addr_ = address; \
-    if ((addr_ >= 0x1000) && (addr_ < mem_top)) memory[addr_] = (uint8_t)(byte); }
-
-#define MEM_READ(address) (((address >= 0x1000) && (address < 0x1400)) ? 0xff : memory[(uint16_t)(address)])
+#define MEM_READ(address) BusRead8080(bus, (uint16_t)(address))
 
 // 8-bit parity calculator from
 // https://stackoverflow.com/questions/21617970/how-to-check-if-value-has-even-parity-of-bits-or-odd/21618038
 
-bool Parity(uint8_t byte) {
+constexpr bool Parity(uint8_t byte) {
   byte ^= byte >> 4;
   byte ^= byte >> 2;
   byte ^= byte >> 1;
   return (byte & 0x01) ? false : true;
 }
 
+// Flag lookup tables, filled in at compile time.  The sign, zero and
+// parity flags for a result are held in the same bit positions as in
+// the PSW.  The auxiliary carry table is indexed by the low nibbles
+// of the accumulator and the operand, the carry (borrow) in, and
+// whether this is a subtraction, as given by AC_INDEX; a subtraction
+// takes the operand before it is complemented.
+
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_P 0x04
+
+#define AC_INDEX(a, b, carry) (((a) & 0x0f) | (((b) & 0x0f) << 4) | ((carry) << 8))
+#define AC_SUB 0x200
+
+struct FlagTables {
+  uint8_t szp[256];
+  bool ac[1024];
+  constexpr FlagTables() : szp(), ac() {
+    for (int i=0; i<256; i++) {
+      szp[i] = (i & 0x80 ? FLAG_S : 0) | (i == 0 ? FLAG_Z : 0) | (Parity(i) ? FLAG_P : 0);
+    }
+    for (int i=0; i<512; i++) {
+      int a = i & 0x0f, b = (i >> 4) & 0x0f, carry = i >> 8;
+      ac[i] = (a + b + carry > 0x0f);
+      ac[i | AC_SUB] = (a + (~b & 0x0f) + 1 + carry > 0x0f);
+    }
+  }
+};
+
+static constexpr FlagTables flag_tables;
+
+// Record the result for the sign, zero and parity flags, and the
+// operands for the auxiliary carry
+
+static inline void SetFlagsSZP(State8080 *state, uint8_t result) {
+  state->flag_res = result;
+  state->pending |= PENDING_SZP;
+}
+
+static inline void SetAuxCarryAdd(State8080 *state, uint8_t a, uint8_t b, bool carry) {
+  state->flag_ac = AC_INDEX(a, b, carry);
+  state->pending |= PENDING_AC;
+}
+
+static inline void SetAuxCarrySub(State8080 *state, uint8_t a, uint8_t b, bool carry) {
+  state->flag_ac = AC_INDEX(a, b, carry) | AC_SUB;
+  state->pending |= PENDING_AC;
+}
+
+static inline void SetAuxCarry(State8080 *state, bool ac) {
+  state->cc.ac = ac;
+  state->pending &= ~PENDING_AC;
+}
+
+// Read a flag, evaluating it if necessary
+
+static inline bool FlagS(const State8080 *state) {
+  return (state->pending & PENDING_SZP) ? (flag_tables.szp[state->flag_res] & FLAG_S) != 0 : state->cc.s;
+}
+
+static inline bool FlagZ(const State8080 *state) {
+  return (state->pending & PENDING_SZP) ? (state->flag_res == 0) : state->cc.z;
+}
+
+static inline bool FlagP(const State8080 *state) {
+  return (state->pending & PENDING_SZP) ? (flag_tables.szp[state->flag_res] & FLAG_P) != 0 : state->cc.p;
+}
+
+static inline bool FlagAC(const State8080 *state) {
+  return (state->pending & PENDING_AC) ? flag_tables.ac[state->flag_ac] : state->cc.ac;
+}
+
+typedef int (*OpHandler8080)(State8080 *state, Bus8080 *bus, const uint8_t *opcode);
+
+// A basic block is a run of instructions ending with one that may
+// transfer control, access a port, halt or change the interrupt
+// enable.  Each instruction is held as its handler, its address and a
+// pointer to it in the page it was read from, so running a block
+// involves no decoding.  The handlers still read the immediate data
+// from memory, as an instruction may overwrite itself.
+
+#define BLOCK_MAX_OPS 32
+#define BLOCK_MAX_BYTES (3 * BLOCK_MAX_OPS)
+
+typedef struct MicroOp8080 {
+  OpHandler8080 handler;
+  const uint8_t *opcode;
+  uint16_t addr;
+} MicroOp8080;
+
+typedef struct Block8080 {
+  uint16_t start;
+  uint16_t end; // address following the last instruction
+  int count;
+  MicroOp8080 op[BLOCK_MAX_OPS];
+} Block8080;
+
+// Blocks are looked up by their start address.  For each byte of
+// memory we count the cached op codes held there, so that a write to
+// code can be caught, and 'flushed' tells a running block that it may
+// have been thrown away.  Code and data are often interleaved (for
+// example in the RAM workspace of BASIC) so this is done per byte
+// rather than per page.  Only the op codes matter, since the immediate
+// data is always read from memory: BASIC patches the operands of some
+// of its RAM routines every time round a loop.
+
+struct BlockCache8080 {
+  Block8080 *block[0x10000];
+  uint8_t code[0x10000];
+  bool flushed;
+};
+
+static void DeleteBlock8080(BlockCache8080 *cache, Block8080 *block) {
+  int i;
+  for (i=0; i<block->count; i++) cache->code[block->op[i].addr]--;
+  cache->block[block->start] = NULL;
+  delete block;
+}
+
+// Throw away all blocks holding an op code at the given address.
+// These must start at most BLOCK_MAX_BYTES before it.
+
+static void InvalidateCode8080(BlockCache8080 *cache, uint16_t address) {
+  int first = address - BLOCK_MAX_BYTES + 1;
+  int i;
+  for (i = (first < 0 ? 0 : first); i <= address; i++) {
+    Block8080 *block = cache->block[i];
+    if (block && (uint16_t)(address - block->start) < (uint16_t)(block->end - block->start)) {
+      DeleteBlock8080(cache, block);
+    }
+  }
+  cache->flushed = true;
+}
+
+// Bus accesses, through a page pointer unless the page has a handler
+
+static inline uint8_t BusRead8080(Bus8080 *bus, uint16_t address) {
+  const uint8_t *page = bus->read[address >> 8];
+  if (page) return page[address & 0xff];
+  return bus->handler[address >> 8](bus->context[address >> 8], address, -1);
+}
+
+static inline void BusWrite8080(State8080 *state, Bus8080 *bus, uint16_t address, uint8_t byte) {
+  uint8_t *page = bus->write[address >> 8];
+  if (page) page[address & 0xff] = byte;
+  else bus->handler[address >> 8](bus->context[address >> 8], address, byte);
+  bus->dirty[address >> 6] = 1;
+  if (state->cache && state->cache->code[address]) InvalidateCode8080(state->cache, address);
+}
+
+// Every page starts out as ROM
+
+void InitBus8080(Bus8080 *bus, uint8_t *memory) {
+  int i;
+  bus->memory = memory;
+  for (i=0; i<256; i++) {
+    bus->blank[i] = 0xff;
+    bus->scratch[i] = 0x00;
+  }
+  for (i=0; i<1024; i++) bus->dirty[i] = 1;
+  MapPages8080(bus, 0x0000, 0x10000, PAGE_ROM);
+}
+
+// Set the attributes of the pages from start up to (not including)
+// end, which should be multiples of 0x100, removing any handlers
+
+void MapPages8080(Bus8080 *bus, int start, int end, uint8_t attr) {
+  int page;
+  for (page = start >> 8; page < (end >> 8) && page < 256; page++) {
+    uint8_t *memory = &bus->memory[page << 8];
+    bus->attr[page] = attr;
+    bus->read[page] = (attr == PAGE_VDU) ? bus->blank : memory;
+    bus->write[page] = (attr == PAGE_ROM) ? bus->scratch : memory;
+    bus->handler[page] = NULL;
+    bus->context[page] = NULL;
+  }
+}
+
+void SetPageHandler8080(Bus8080 *bus, int page, PageHandler8080 handler, void *context) {
+  bus->read[page] = NULL;
+  bus->write[page] = NULL;
+  bus->handler[page] = handler;
+  bus->context[page] = context;
+}
+
+// Write to memory from outside the processor, as a store instruction
+// would, so that the dirty marks and the code cache are kept right
+
+void WriteMemory8080(State8080 *state, Bus8080 *bus, uint16_t address, uint8_t byte) {
+  BusWrite8080(state, bus, address, byte);
+}
+
+// Bring the condition codes up to date
+
+void SyncFlags8080(State8080 *state) {
+  if (state->pending & PENDING_SZP) {
+    uint8_t flags = flag_tables.szp[state->flag_res];
+    state->cc.s = (flags & FLAG_S) != 0;
+    state->cc.z = (flags & FLAG_Z) != 0;
+    state->cc.p = (flags & FLAG_P) != 0;
+  }
+  if (state->pending & PENDING_AC) state->cc.ac = flag_tables.ac[state->flag_ac];
+  state->pending = 0;
+}
+
 // Final '\n' is omitted to allow for inline printing
 
 void WriteStatus8080(FILE *fp, State8080 *state) {
+  SyncFlags8080(state);
   fprintf(fp, "A=%02X ", state->a);
   fprintf(fp, "BC=%02X%02X ", state->b, state->c);
   fprintf(fp, "DE=%02X%02X ", state->d, state->e);
@@ -100,1663 +306,972 @@ void Reset8080(State8080 *state) {
   state->halted = false;
 }
 
-int SingleStep8080(State8080 *state, uint8_t *memory) { // return the number of machine cycles
-  uint8_t *opcode = &memory[state->pc];
-  uint8_t current_opcode;
-  bool handling_interrupt = false;
+// The op code handlers: opcode points to the instruction (op code and
+// any immediate data), which may have been jammed by an interrupt
+
+// NOP - No-operation
+
+static int NOP(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->pc++;
+  return 4;
+}
+
+// Registers are numbered as in the op codes: B C D E H L M A, where M
+// (6) is the memory location addressed by H & L.  Register pairs are
+// B, D, H and SP (or PSW for PUSH and POP), and the conditions are
+// NZ Z NC C PO PE P M.  The handlers below are templates on these
+// numbers, and the compiler produces one function for each op code.
+
+#define REG_B 0
+#define REG_C 1
+#define REG_D 2
+#define REG_E 3
+#define REG_H 4
+#define REG_L 5
+#define REG_M 6
+#define REG_A 7
+
+#define PAIR_B  0
+#define PAIR_D  1
+#define PAIR_H  2
+#define PAIR_SP 3
+
+template <int R> static inline uint8_t &Reg(State8080 *state) {
+  static_assert(R != REG_M, "M is not a register");
+  if constexpr (R == REG_B) return state->b;
+  else if constexpr (R == REG_C) return state->c;
+  else if constexpr (R == REG_D) return state->d;
+  else if constexpr (R == REG_E) return state->e;
+  else if constexpr (R == REG_H) return state->h;
+  else if constexpr (R == REG_L) return state->l;
+  else return state->a;
+}
+
+// Read or write a register, or the memory addressed by H & L
+
+template <int R> static inline uint8_t GetReg(State8080 *state, Bus8080 *bus) {
+  if constexpr (R == REG_M) return MEM_READ((state->h << 8) | state->l);
+  else return Reg<R>(state);
+}
+
+template <int R> static inline void SetReg(State8080 *state, Bus8080 *bus, uint8_t byte) {
+  if constexpr (R == REG_M) MEM_WRITE((state->h << 8) | state->l, byte);
+  else Reg<R>(state) = byte;
+}
+
+// Read or write a register pair
+
+template <int RP> static inline uint16_t GetPair(const State8080 *state) {
+  if constexpr (RP == PAIR_B) return (state->b << 8) | state->c;
+  else if constexpr (RP == PAIR_D) return (state->d << 8) | state->e;
+  else if constexpr (RP == PAIR_H) return (state->h << 8) | state->l;
+  else return state->sp;
+}
+
+template <int RP> static inline void SetPair(State8080 *state, uint16_t word) {
+  if constexpr (RP == PAIR_SP) state->sp = word;
+  else {
+    Reg<2 * RP>(state) = word >> 8;
+    Reg<2 * RP + 1>(state) = word & 0xff;
+  }
+}
+
+// Test a condition
+
+template <int CC> static inline bool Condition(const State8080 *state) {
+  if constexpr (CC == 0) return !FlagZ(state);
+  else if constexpr (CC == 1) return FlagZ(state);
+  else if constexpr (CC == 2) return !state->cc.cy;
+  else if constexpr (CC == 3) return state->cc.cy;
+  else if constexpr (CC == 4) return !FlagP(state);
+  else if constexpr (CC == 5) return FlagP(state);
+  else if constexpr (CC == 6) return !FlagS(state);
+  else return FlagS(state);
+}
+
+// LXI rp - Load immediate register pair
+
+template <int RP> static int LXI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetPair<RP>(state, (opcode[2] << 8) | opcode[1]);
+  state->pc += 3;
+  return 10;
+}
+
+// STAX rp - Store accumulator
+
+template <int RP> static int STAX(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  MEM_WRITE(GetPair<RP>(state), state->a);
+  state->pc++;
+  return 7;
+}
+
+// LDAX rp - Load accumulator
+
+template <int RP> static int LDAX(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a = MEM_READ(GetPair<RP>(state));
+  state->pc++;
+  return 7;
+}
+
+// INX rp - Increment register pair
+
+template <int RP> static int INX(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetPair<RP>(state, GetPair<RP>(state) + 1);
+  state->pc++;
+  return 5;
+}
+
+// DCX rp - Decrement register pair
+
+template <int RP> static int DCX(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetPair<RP>(state, GetPair<RP>(state) - 1);
+  state->pc++;
+  return 5;
+}
+
+// DAD rp - Double add
+
+template <int RP> static int DAD(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = GetPair<PAIR_H>(state) + GetPair<RP>(state);
+  state->cc.cy = (answer > 0xffff);
+  SetPair<PAIR_H>(state, answer & 0xffff);
+  state->pc++;
+  return 10;
+}
+
+// INR r - Increment register or memory
+
+template <int R> static int INR(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  uint8_t byte = GetReg<R>(state, bus);
+  SetAuxCarryAdd(state, byte, 0, 1);
+  SetFlagsSZP(state, byte + 1);
+  SetReg<R>(state, bus, byte + 1);
+  state->pc++;
+  return R == REG_M ? 10 : 5;
+}
+
+// DCR r - Decrement register or memory
+
+template <int R> static int DCR(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  uint8_t byte = GetReg<R>(state, bus);
+  SetAuxCarryAdd(state, byte, 0, 1);
+  SetFlagsSZP(state, byte - 1);
+  SetReg<R>(state, bus, byte - 1);
+  state->pc++;
+  return R == REG_M ? 10 : 5;
+}
+
+// MVI r - Move immediate to register or memory
+
+template <int R> static int MVI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetReg<R>(state, bus, opcode[1]);
+  state->pc += 2;
+  return R == REG_M ? 10 : 7;
+}
+
+// MOV d,s - Move register or memory to register or memory (MOV M,M
+// is HLT)
+
+template <int D, int S> static int MOV(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetReg<D>(state, bus, GetReg<S>(state, bus));
+  state->pc++;
+  return (D == REG_M || S == REG_M) ? 7 : 5;
+}
+
+// ADD r - Add register or memory to A
+
+template <int R> static int ADD(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  uint8_t byte = GetReg<R>(state, bus);
+  answer = (int) state->a + (int) byte;
+  SetAuxCarryAdd(state, state->a, byte, 0);
+  state->cc.cy = (answer > 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// ADC r - Add register or memory to A with carry
+
+template <int R> static int ADC(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  uint8_t byte = GetReg<R>(state, bus);
+  answer = (int) state->a + (int) byte + (int) state->cc.cy;
+  SetAuxCarryAdd(state, state->a, byte, state->cc.cy);
+  state->cc.cy = (answer > 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// SUB r - Subtract register or memory from A
+
+template <int R> static int SUB(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  uint8_t byte = GetReg<R>(state, bus);
+  answer = (int) state->a + (int) (~byte & 0xff) + 1;
+  SetAuxCarrySub(state, state->a, byte, 0);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// SBB r - Subtract register or memory from A with borrow
+
+template <int R> static int SBB(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  uint8_t byte = GetReg<R>(state, bus);
+  answer = (int) state->a + (int) (~byte & 0xff) + 1;
+  answer -= (int) state->cc.cy;
+  SetAuxCarrySub(state, state->a, byte, state->cc.cy);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// ANA r - Logical AND register or memory with accumulator
+
+template <int R> static int ANA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a &= GetReg<R>(state, bus);
+  SetFlagsSZP(state, state->a);
+  state->cc.cy = false;
+  SetAuxCarry(state, false);
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// XRA r - Logical exclusive-OR register or memory with accumulator
+
+template <int R> static int XRA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a ^= GetReg<R>(state, bus);
+  SetFlagsSZP(state, state->a);
+  state->cc.cy = false;
+  SetAuxCarry(state, false);
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// ORA r - Logical OR register or memory with accumulator
+
+template <int R> static int ORA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a |= GetReg<R>(state, bus);
+  SetFlagsSZP(state, state->a);
+  state->cc.cy = false;
+  SetAuxCarry(state, false);
+  state->pc++;
+  return R == REG_M ? 7 : 4;
+}
+
+// CMP r - Compare register with accumulator
+
+template <int R> static int CMP(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  uint8_t byte = GetReg<R>(state, bus);
+  answer = (int) state->a + (int) (~byte & 0xff) + 1;
+  SetAuxCarrySub(state, state->a, byte, 0);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->pc++;
+  return 4;
+}
+
+// CMP M - Compare memory with accumulator (the auxiliary carry is
+// found from L, and this takes 4 cycles, as it always has here)
+
+template <> int CMP<REG_M>(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
   int answer;
+  answer = (int) state->a + (int) (~GetReg<REG_M>(state, bus) & 0xff) + 1;
+  SetAuxCarrySub(state, state->a, state->l, 0);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->pc++;
+  return 4;
+}
+
+// CMP A - Compare accumulator with itself (sets the carry, as it
+// always has here)
+
+template <> int CMP<REG_A>(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  SetAuxCarrySub(state, state->a, state->a, 0);
+  state->cc.cy = true;
+  SetFlagsSZP(state, 0x00);
+  state->pc++;
+  return 4;
+}
+
+// Jcc - Jump on condition
+
+template <int CC> static int Jcc(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  if (Condition<CC>(state)) state->pc = (opcode[2] << 8) | opcode[1];
+  else state->pc += 3;
+  return 10;
+}
+
+// Ccc - Call on condition
+
+template <int CC> static int Ccc(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
   int offset;
-  //printStatus(state);
-  if (state->halted) return 0;
-  if (state->interrupt && state->int_enable) { // service the interrupt
-    handling_interrupt = true;
-    current_opcode = state->interrupt;
-    state->interrupt = 0x00;
-    state->int_enable = false; // disable interrupts
-  } else { // normal operation
-    current_opcode = opcode[0];
-  }
-  switch(current_opcode) {
-  case 0x00: // NOP - No-operation
-  case 0x08:
-  case 0x10:
-  case 0x18:
-  case 0x20:
-  case 0x28:
-  case 0x30:
-  case 0x38:
-    state->pc++;
-    return 4;
-  case 0x01: // LXI B - Load immediate register pair B & C
-    state->c = opcode[1];
-    state->b = opcode[2];
-    state->pc += 3;
-    return 10;
-  case 0x02: // STAX B - Store accumulator
-    offset = (state->b << 8) | (state->c);
-    MEM_WRITE(offset, state->a);
-    state->pc++;
-    return 7;
-  case 0x03: // INX B - Increment register pair
-    answer = (state->b << 8) | (state->c);
-    answer++;
-    state->b = (answer >> 8) & 0xff;
-    state->c = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x04: // INR B - Increment register
-    answer = (int) state->b + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->b & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->b = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x05: // DCR B - Decrement register
-    answer = (int) state->b + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->b & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->b = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x06: // MVI B - Move immediate register
-    state->b = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x07: // RLC - Rotate accumulator left
-    state->cc.cy = ((state->a & 0x80) != 0);
-    state->a = (state->a << 1) & 0xff;
-    state->a += state->cc.cy;
-    state->pc++;
-    return 4;
-    //case 0x08: Duplicate of NOP
-  case 0x09: // DAD B - Double add
-    offset = (state->h << 8) | (state->l);
-    answer = (state->b << 8) | (state->c);
-    state->cc.cy = (offset + answer > 0xffff);
-    answer += offset;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 10;
-  case 0x0a: // LDAX B - Load accumulator
-    offset = (state->b << 8) | (state->c);
-    state->a = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x0b: // DCX B - Decrement register pair
-    answer = (state->b << 8) | (state->c);
-    answer--;
-    state->b = (answer >> 8) & 0xff;
-    state->c = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x0c: // INR C - Increment register
-    answer = (int) state->c + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->c & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->c = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x0d: // DCR C - Decrement register
-    answer = (int) state->c + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->c & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->c = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x0e: // MVI C - Move immediate register
-    state->c = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x0f: // RRC - Rotate accumulator right
-    state->cc.cy = ((state->a & 0x01) != 0);
-    state->a = (state->a >> 1) & 0xff;
-    state->a += state->cc.cy << 7;
-    state->pc++;
-    return 4;
-    //case 0x10: Duplicate of NOP
-  case 0x11: // LXI D - Load immediate register pair D & E
-    state->e = opcode[1];
-    state->d = opcode[2];
-    state->pc += 3;
-    return 10;
-  case 0x12: // STAX D - Store accumulator
-    offset = (state->d << 8) | (state->e);
-    MEM_WRITE(offset, state->a);
-    state->pc++;
-    return 7;
-  case 0x13: // INX D - Increment register pair
-    answer = (state->d << 8) | (state->e);
-    answer++;
-    state->d = (answer >> 8) & 0xff;
-    state->e = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x14: // INR D - Increment register
-    answer = (int) state->d + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->d & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->d = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x15: // DCR D - Decrement register
-    answer = (int) state->d + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->d & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->d = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x16: // MVI D - Move immediate register
-    state->d = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x17: // RAL - Rotate accumulator left through carry
-    answer = (int) state->a << 1;
-    answer += state->cc.cy;
-    state->cc.cy = (answer > 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-    //case 0x18: Duplicate of NOP
-  case 0x19: // DAD D - Double add
-    offset = (state->h << 8) | (state->l);
-    answer = (state->d << 8) | (state->e);
-    state->cc.cy = (offset + answer > 0xffff);
-    answer += offset;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 10;
-  case 0x1a: // LDAX D - Load accumulator
-    offset = (state->d << 8) | (state->e);
-    state->a = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x1b: // DCX D - Decrement register pair
-    answer = (state->d << 8) | (state->e);
-    answer--;
-    state->d = (answer >> 8) & 0xff;
-    state->e = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x1c: // INR E - Increment register
-    answer = (int) state->e + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->e & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->e = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x1d: // DCR E - Decrement register
-    answer = (int) state->e + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->e & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->e = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x1e: // MVI E - Move immediate register
-    state->e = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x1f: // RAR - Rotate accumulator right through carry
-    answer = (int) state->a >> 1;
-    answer += state->cc.cy << 7;
-    state->cc.cy = ((state->a & 0x01) != 0);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-    //case 0x20: Duplicate of NOP
-  case 0x21: // LXI H - Load immediate register pair H & L
-    state->l = opcode[1];
-    state->h = opcode[2];
-    state->pc += 3;
-    return 10;
-  case 0x22: // SHLD - Store H and L direct
-    offset = (opcode[2] << 8) | opcode[1];
-    MEM_WRITE(offset, state->l);
-    MEM_WRITE(offset + 1, state->h);
-    state->pc += 3;
-    return 16;
-  case 0x23: // INX H - Increment register pair
-    answer = (state->h << 8) | (state->l);
-    answer++;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x24: // INR H - Increment register
-    answer = (int) state->h + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->h & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->h = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x25: // DCR H - Decrement register
-    answer = (int) state->h + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->h & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->h = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x26: // MVI H - Move immediate register
-    state->h = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x27: // DAA - Decimal adjust accumulator
-    if (((state->a & 0x0f) > 0x09) | (state->cc.ac != 0)) {
-      state->a += 0x06;
-      state->cc.ac = true;
-    } else state->cc.ac = false;
-    if (((state->a & 0xf0) > 0x90) | (state->cc.cy != 0)) {
-      state->a = (state->a + 0x60) & 0xff;
-      state->cc.cy = true;
-    }
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a);
-    state->pc++;
-    return 4;
-    //case 0x28: Duplicate of NOP
-  case 0x29: // DAD H - Double add
-    offset = (state->h << 8) | (state->l);
-    answer = (state->h << 8) | (state->l);
-    state->cc.cy = (offset + answer > 0xffff);
-    answer += offset;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 10;
-  case 0x2a: // LHLD - Load H and L direct
-    offset = (opcode[2] << 8) | opcode[1];
-    state->l = MEM_READ(offset);
-    state->h = MEM_READ(offset + 1);
-    state->pc += 3;
-    return 16;
-  case 0x2b: // DCX H - Decrement register pair
-    answer = (state->h << 8) | (state->l);
-    answer--;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x2c: // INR L - Increment register
-    answer = (int) state->l + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->l & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->l = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x2d: // DCR L - Decrement register
-    answer = (int) state->l + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->l & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->l = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x2e: // MVI L - Move immediate register
-    state->l = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x2f: // CMA - Complement accumulator
-    state->a = ~state->a & 0xff;
-    state->pc++;
-    return 4;
-    //case 0x30: Duplicate of NOP
-  case 0x31: // LXI SP - Load immediate register pair B & C
-    state->sp = (opcode[2] << 8) + opcode[1];
-    state->pc += 3;
-    return 10;
-  case 0x32: // STA - Store accumulator direct
-    offset = (opcode[2] << 8) | opcode[1];
-    MEM_WRITE(offset, state->a);
-    state->pc += 3;
-    return 13;
-  case 0x33: // INX SP - Increment register pair
-    state->sp++;
-    state->pc++;
-    return 5;
-  case 0x34: // INR M - Increment memory
-    offset = (state->h << 8) | (state->l);
-    answer = (int) MEM_READ(offset) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((MEM_READ(offset) & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    MEM_WRITE(offset, answer & 0xff);
-    state->pc++;
-    return 10;
-  case 0x35: // DCR M - Decrement memory
-    offset = (state->h << 8) | (state->l);
-    answer = (int) MEM_READ(offset) + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((MEM_READ(offset) & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    MEM_WRITE(offset, answer & 0xff);
-    state->pc++;
-    return 10;
-  case 0x36: // MVI M - Move immediate memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, opcode[1]);
-    state->pc += 2;
-    return 10;
-  case 0x37: // STC - Set Carry
+  if (Condition<CC>(state)) {
+    offset = state->pc + 3;
+    MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
+    MEM_WRITE(state->sp - 2, (offset & 0xff));
+    state->sp -= 2;
+    state->pc = (opcode[2] << 8) | opcode[1];
+  } else state->pc += 3;
+  return 11;
+}
+
+// Rcc - Return on condition
+
+template <int CC> static int Rcc(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  if (Condition<CC>(state)) {
+    state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
+    state->sp += 2;
+  } else state->pc++;
+  return 11;
+}
+
+// PUSH rp - Push register pair onto stack
+
+template <int RP> static int PUSH(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  uint16_t word = GetPair<RP>(state);
+  MEM_WRITE(state->sp - 1, word >> 8);
+  MEM_WRITE(state->sp - 2, word & 0xff);
+  state->sp -= 2;
+  state->pc++;
+  return 11;
+}
+
+// POP rp - Pop register pair off stack
+
+template <int RP> static int POP(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  uint8_t low = MEM_READ(state->sp);
+  SetPair<RP>(state, (MEM_READ(state->sp + 1) << 8) | low);
+  state->sp += 2;
+  state->pc++;
+  return 10;
+}
+
+// RLC - Rotate accumulator left
+
+static int RLC(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->cc.cy = ((state->a & 0x80) != 0);
+  state->a = (state->a << 1) & 0xff;
+  state->a += state->cc.cy;
+  state->pc++;
+  return 4;
+}
+
+// RRC - Rotate accumulator right
+
+static int RRC(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->cc.cy = ((state->a & 0x01) != 0);
+  state->a = (state->a >> 1) & 0xff;
+  state->a += state->cc.cy << 7;
+  state->pc++;
+  return 4;
+}
+
+// RAL - Rotate accumulator left through carry
+
+static int RAL(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a << 1;
+  answer += state->cc.cy;
+  state->cc.cy = (answer > 0xff);
+  state->a = answer & 0xff;
+  state->pc++;
+  return 4;
+}
+
+// RAR - Rotate accumulator right through carry
+
+static int RAR(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a >> 1;
+  answer += state->cc.cy << 7;
+  state->cc.cy = ((state->a & 0x01) != 0);
+  state->a = answer & 0xff;
+  state->pc++;
+  return 4;
+}
+
+// SHLD - Store H and L direct
+
+static int SHLD(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (opcode[2] << 8) | opcode[1];
+  MEM_WRITE(offset, state->l);
+  MEM_WRITE(offset + 1, state->h);
+  state->pc += 3;
+  return 16;
+}
+
+// DAA - Decimal adjust accumulator
+
+static int DAA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  if (((state->a & 0x0f) > 0x09) | FlagAC(state)) {
+    state->a += 0x06;
+    SetAuxCarry(state, true);
+  } else SetAuxCarry(state, false);
+  if (((state->a & 0xf0) > 0x90) | (state->cc.cy != 0)) {
+    state->a = (state->a + 0x60) & 0xff;
     state->cc.cy = true;
+  }
+  SetFlagsSZP(state, state->a);
+  state->pc++;
+  return 4;
+}
+
+// LHLD - Load H and L direct
+
+static int LHLD(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (opcode[2] << 8) | opcode[1];
+  state->l = MEM_READ(offset);
+  state->h = MEM_READ(offset + 1);
+  state->pc += 3;
+  return 16;
+}
+
+// CMA - Complement accumulator
+
+static int CMA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a = ~state->a & 0xff;
+  state->pc++;
+  return 4;
+}
+
+// STA - Store accumulator direct
+
+static int STA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (opcode[2] << 8) | opcode[1];
+  MEM_WRITE(offset, state->a);
+  state->pc += 3;
+  return 13;
+}
+
+// STC - Set Carry
+
+static int STC(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->cc.cy = true;
+  state->pc++;
+  return 4;
+}
+
+// LDA - Load accumulator direct
+
+static int LDA(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (opcode[2] << 8) | opcode[1];
+  state->a = MEM_READ(offset);
+  state->pc += 3;
+  return 13;
+}
+
+// CMC - Complement Carry
+
+static int CMC(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->cc.cy = !(state->cc.cy);
+  state->pc++;
+  return 4;
+}
+
+// HLT - Halt
+
+static int HLT(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->halted = true;
+  return 7;
+}
+
+// JMP - Jump
+
+static int JMP(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->pc = (opcode[2] << 8) | opcode[1];
+  return 10;
+}
+
+// ADI - Add immediate to A
+
+static int ADI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a + (int) opcode[1];
+  SetAuxCarryAdd(state, state->a, opcode[1], 0);
+  state->cc.cy = (answer > 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc += 2;
+  return 7;
+}
+
+// Push the program counter and vector to the restart address; this is
+// also used to service an interrupt, for which the PC is not advanced
+
+static int Restart(State8080 *state, Bus8080 *bus, uint8_t current_opcode) {
+  MEM_WRITE(state->sp - 2, state->pc & 0xff);
+  MEM_WRITE(state->sp - 1, state->pc >> 8);
+  state->sp -= 2;
+  state->pc = (int) current_opcode & 0x38;
+  return 11;
+}
+
+// RST - call subroutine at specified location
+
+static int RST(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->pc++;
+  return Restart(state, bus, opcode[0]);
+}
+
+// RET - Return
+
+static int RET(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
+  state->sp += 2;
+  return 10;
+}
+
+// CALL - Call
+
+static int CALL(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = state->pc + 3;
+  MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
+  MEM_WRITE(state->sp - 2, (offset & 0xff));
+  state->sp -= 2;
+  state->pc = (opcode[2] << 8) | opcode[1];
+  return 17;
+}
+
+// ACI - Add immediate to A with carry
+
+static int ACI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a + (int) opcode[1] + (int) state->cc.cy;
+  SetAuxCarryAdd(state, state->a, opcode[1], state->cc.cy);
+  state->cc.cy = (answer > 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc += 2;
+  return 7;
+}
+
+// OUT - output to port
+
+static int OUT(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->port_op = opcode[0];
+  state->port = opcode[1];
+  state->pc += 2;
+  return 10;
+}
+
+// SUI - Subtract immediate from A
+
+static int SUI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
+  SetAuxCarrySub(state, state->a, opcode[1], 0);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc += 2;
+  return 7;
+}
+
+// IN - Input from port
+
+static int IN(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->port_op = opcode[0];
+  state->port = opcode[1];
+  state->pc += 2;
+  return 10;
+}
+
+// SBI - Subtract immediate from A with borrow
+
+static int SBI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
+  answer -= (int) state->cc.cy;
+  SetAuxCarrySub(state, state->a, opcode[1], state->cc.cy);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->a = answer & 0xff;
+  state->pc += 2;
+  return 7;
+}
+
+// XTHL - Exchange stack
+
+static int XTHL(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (state->h << 8) | (state->l);
+  state->l = MEM_READ(state->sp);
+  state->h = MEM_READ(state->sp + 1);
+  MEM_WRITE(state->sp + 1, offset >> 8);
+  MEM_WRITE(state->sp, offset & 0xff);
+  state->pc++;
+  return 18;
+}
+
+// ANI - AND immediate with accumulator
+
+static int ANI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a &= opcode[1];
+  state->cc.cy = false;
+  SetFlagsSZP(state, state->a);
+  state->pc += 2;
+  return 7;
+}
+
+// PCHL - Load program counter
+
+static int PCHL(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->pc = (state->h << 8) | state->l;
+  return 5;
+}
+
+// XCHG - Exchange registers
+
+static int XCHG(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int offset;
+  offset = (state->h << 8) | (state->l);
+  state->h = state->d;
+  state->l = state->e;
+  state->d = offset >> 8;
+  state->e = offset & 0xff;
+  state->pc++;
+  return 4;
+}
+
+// XRI - Exclusive-OR immediate with accumulator
+
+static int XRI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a ^= opcode[1];
+  state->cc.cy = false;
+  SetFlagsSZP(state, state->a);
+  state->pc += 2;
+  return 7;
+}
+
+// POP PSW - Pop data off stack
+
+static int POP_PSW(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->cc.s = ((MEM_READ(state->sp) & 0x80) > 0);
+  state->cc.z = ((MEM_READ(state->sp) & 0x40) > 0);
+  state->cc.ac = ((MEM_READ(state->sp) & 0x10) > 0);
+  state->cc.p = ((MEM_READ(state->sp) & 0x04) > 0);
+  state->pending = 0;
+  state->cc.cy = ((MEM_READ(state->sp) & 0x01) > 0);
+  state->a = MEM_READ(state->sp + 1);
+  state->sp += 2;
+  state->pc++;
+  return 10;
+}
+
+// DI - Disable interrupts
+
+static int DI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->int_enable = false;
+  state->pc++;
+  return 4;
+}
+
+// PUSH PSW - Push data onto stack
+
+static int PUSH_PSW(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  SyncFlags8080(state);
+  answer = state->cc.cy + 0x10;
+  answer += state->cc.p << 2;
+  answer += state->cc.ac << 4;
+  answer += state->cc.z << 6;
+  answer += state->cc.s << 7;
+  MEM_WRITE(state->sp - 2, answer & 0xff);
+  MEM_WRITE(state->sp - 1, state->a);
+  state->sp -= 2;
+  state->pc++;
+  return 11;
+}
+
+// ORI - OR immediate with accumulator
+
+static int ORI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->a |= opcode[1];
+  state->cc.cy = false;
+  SetFlagsSZP(state, state->a);
+  state->pc += 2;
+  return 7;
+}
+
+// SPHL - Load SP from H and L
+
+static int SPHL(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->sp = (state->h << 8) | (state->l);
+  state->pc++;
+  return 5;
+}
+
+// EI - Enable interrupts
+
+static int EI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  state->int_enable = true;
+  state->pc++;
+  return 4;
+}
+
+// CPI - Compare immediate with accumulator
+
+static int CPI(State8080 *state, Bus8080 *bus, const uint8_t *opcode) {
+  int answer;
+  answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
+  SetAuxCarrySub(state, state->a, opcode[1], 0);
+  state->cc.cy = (answer <= 0xff);
+  SetFlagsSZP(state, answer & 0xff);
+  state->pc += 2;
+  return 7;
+}
+
+// The handler for an op code, decoded from its fields: bits 7-6
+// select the group, bits 5-3 the destination register, register pair
+// or condition, and bits 2-0 the source register or operation
+
+template <int OP> static constexpr OpHandler8080 Decode8080() {
+  constexpr int G = OP >> 6, Y = (OP >> 3) & 7, Z = OP & 7, RP = Y >> 1;
+  if constexpr (OP == 0x76) return HLT;
+  else if constexpr (G == 1) return MOV<Y, Z>;
+  else if constexpr (G == 2) {
+    constexpr OpHandler8080 alu[8] = {ADD<Z>, ADC<Z>, SUB<Z>, SBB<Z>, ANA<Z>, XRA<Z>, ORA<Z>, CMP<Z>};
+    return alu[Y];
+  } else if constexpr (G == 0) {
+    constexpr OpHandler8080 load[8] = {STAX<PAIR_B>, LDAX<PAIR_B>, STAX<PAIR_D>, LDAX<PAIR_D>, SHLD, LHLD, STA, LDA};
+    constexpr OpHandler8080 rotate[8] = {RLC, RRC, RAL, RAR, DAA, CMA, STC, CMC};
+    constexpr OpHandler8080 column[8] = {NOP, (Y & 1) ? DAD<RP> : LXI<RP>, load[Y],
+					 (Y & 1) ? DCX<RP> : INX<RP>, INR<Y>, DCR<Y>, MVI<Y>, rotate[Y]};
+    return column[Z];
+  } else {
+    constexpr OpHandler8080 pop[4] = {POP<PAIR_B>, POP<PAIR_D>, POP<PAIR_H>, POP_PSW};
+    constexpr OpHandler8080 push[4] = {PUSH<PAIR_B>, PUSH<PAIR_D>, PUSH<PAIR_H>, PUSH_PSW};
+    constexpr OpHandler8080 misc1[4] = {RET, RET, PCHL, SPHL};
+    constexpr OpHandler8080 misc3[8] = {JMP, JMP, OUT, IN, XTHL, XCHG, DI, EI};
+    constexpr OpHandler8080 immediate[8] = {ADI, ACI, SUI, SBI, ANI, XRI, ORI, CPI};
+    constexpr OpHandler8080 column[8] = {Rcc<Y>, (Y & 1) ? misc1[RP] : pop[RP], Jcc<Y>, misc3[Y],
+					 Ccc<Y>, (Y & 1) ? CALL : push[RP], immediate[Y], RST};
+    return column[Z];
+  }
+}
+
+template <size_t... OP> static constexpr std::array<OpHandler8080, 256> OpcodeTable8080(std::index_sequence<OP...>) {
+  return {{Decode8080<OP>()...}};
+}
+
+static constexpr std::array<OpHandler8080, 256> opcode_table = OpcodeTable8080(std::make_index_sequence<256>());
+
+// The number of bytes in an instruction, and whether it ends a block
+
+static int InstructionLength(uint8_t op) {
+  if ((op & 0xcf) == 0x01) return 3; // LXI
+  if ((op & 0xe7) == 0x22) return 3; // SHLD, LHLD, STA, LDA
+  if ((op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4) return 3; // Jcc and Ccc
+  if (op == 0xc3 || op == 0xcb || (op & 0xcf) == 0xcd) return 3; // JMP and CALL
+  if ((op & 0xc7) == 0x06) return 2; // MVI
+  if ((op & 0xc7) == 0xc6) return 2; // ADI, ACI, SUI, SBI, ANI, XRI, ORI, CPI
+  if (op == 0xd3 || op == 0xdb) return 2; // OUT and IN
+  return 1;
+}
+
+static bool EndsBlock(uint8_t op) {
+  if ((op & 0xc0) != 0xc0) return (op == 0x76); // HLT
+  switch (op & 0x07) {
+  case 0x00: case 0x02: case 0x04: case 0x07: return true; // Rcc, Jcc, Ccc, RST
+  }
+  switch (op) {
+  case 0xc3: case 0xcb: case 0xc9: case 0xd9: // JMP, RET
+  case 0xcd: case 0xdd: case 0xed: case 0xfd: // CALL
+  case 0xe9: case 0xd3: case 0xdb: case 0xf3: case 0xfb: // PCHL, OUT, IN, DI, EI
+    return true;
+  }
+  return false;
+}
+
+// Decode the block starting at pc.  A block stays within one page,
+// and pages with a handler are never cached.  Returns NULL if not
+// even one instruction could be decoded.
+
+static Block8080 *BuildBlock8080(BlockCache8080 *cache, Bus8080 *bus, uint16_t pc) {
+  const uint8_t *page = bus->read[pc >> 8];
+  int addr = pc;
+  int i, len;
+  if (page == NULL) return NULL;
+  Block8080 *block = new Block8080;
+  block->start = pc;
+  block->count = 0;
+  while (block->count < BLOCK_MAX_OPS && (addr >> 8) == (pc >> 8)) {
+    uint8_t op = page[addr & 0xff];
+    len = InstructionLength(op);
+    if ((addr & 0xff) + len > 0x100) break;
+    MicroOp8080 *uop = &block->op[block->count++];
+    uop->handler = opcode_table[op];
+    uop->opcode = &page[addr & 0xff];
+    uop->addr = addr;
+    addr += len;
+    if (EndsBlock(op)) break;
+  }
+  if (block->count == 0) {
+    delete block;
+    return NULL;
+  }
+  block->end = addr & 0xffff;
+  for (i=0; i<block->count; i++) cache->code[block->op[i].addr]++;
+  cache->block[pc] = block;
+  return block;
+}
+
+void FlushCache8080(State8080 *state) {
+  int i;
+  if (state->cache == NULL) return;
+  for (i=0; i<0x10000; i++) {
+    if (state->cache->block[i]) DeleteBlock8080(state->cache, state->cache->block[i]);
+  }
+  state->cache->flushed = true;
+}
+
+void EnableCache8080(State8080 *state, bool enable) {
+  if (enable && state->cache == NULL) state->cache = new BlockCache8080();
+  if (!enable && state->cache != NULL) {
+    FlushCache8080(state);
+    delete state->cache;
+    state->cache = NULL;
+  }
+}
+
+// Execute an instruction which has to be fetched byte by byte, as it
+// runs off the end of its page or the page has a handler, or service
+// a pending interrupt
+
+static int ExecuteFetched8080(State8080 *state, Bus8080 *bus) {
+  uint8_t opcode[3];
+  opcode[0] = MEM_READ(state->pc);
+  opcode[1] = MEM_READ(state->pc + 1);
+  opcode[2] = MEM_READ(state->pc + 2);
+  if (state->interrupt && state->int_enable) { // service the interrupt
+    opcode[0] = state->interrupt;
+    state->interrupt = 0x00;
+    state->int_enable = false; // disable interrupts
+    if ((opcode[0] & 0xc7) == 0xc7) return Restart(state, bus, opcode[0]);
+  }
+  return opcode_table[opcode[0]](state, bus, opcode);
+}
+
+// Execute one instruction, or service a pending interrupt, returning
+// the number of machine cycles.  The instruction is normally used in
+// place in its page.
+
+static inline int Execute8080(State8080 *state, Bus8080 *bus) {
+  const uint8_t *page = bus->read[state->pc >> 8];
+  if (page == NULL || (state->pc & 0xff) >= 0xfe || (state->interrupt && state->int_enable)) {
+    return ExecuteFetched8080(state, bus);
+  }
+  return opcode_table[page[state->pc & 0xff]](state, bus, &page[state->pc & 0xff]);
+}
+
+// Execute one instruction as above, counting it in the profile
+
+static int ProfileExecute8080(State8080 *state, Bus8080 *bus) {
+  Profile8080 *profile = state->profile;
+  uint16_t pc = state->pc;
+  uint8_t op = (state->interrupt && state->int_enable) ? state->interrupt : MEM_READ(pc);
+  int cycles = Execute8080(state, bus);
+  profile->count[pc]++;
+  profile->cycles[pc] += cycles;
+  profile->op_count[op]++;
+  profile->op_cycles[op] += cycles;
+  return cycles;
+}
+
+// Start the profiler with all counts zero, or stop it and throw the
+// counts away
+
+void EnableProfile8080(State8080 *state, bool enable) {
+  if (enable && state->profile == NULL) state->profile = new Profile8080();
+  if (!enable && state->profile != NULL) {
+    delete state->profile;
+    state->profile = NULL;
+  }
+}
+
+// An interrupt, if enabled, brings the processor out of a halt and is
+// serviced with the return address after the HLT
+
+static inline void WakeUp8080(State8080 *state) {
+  if (state->halted && state->interrupt && state->int_enable) {
+    state->halted = false;
     state->pc++;
-    return 4;
-    //case 0x38: Duplicate of NOP
-  case 0x39: // DAD SP - Double add
-    offset = (state->h << 8) | (state->l);
-    answer = state->sp;
-    state->cc.cy = (offset + answer > 0xffff);
-    answer += offset;
-    state->h = (answer >> 8) & 0xff;
-    state->l = answer & 0xff;
-    state->pc++;
-    return 10;
-  case 0x3a: // LDA - Load accumulator direct
-    offset = (opcode[2] << 8) | opcode[1];
-    state->a = MEM_READ(offset);
-    state->pc += 3;
-    return 13;
-  case 0x3b: // DCX SP - Decrement register pair
-    state->sp--;
-    state->pc++;
-    return 5;
-  case 0x3c:// INR A - Increment register
-    answer = (int) state->a + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x3d: // DCR A - Decrement register
-    answer = (int) state->a + 0xff;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + 1 > 0x0f);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 5;
-  case 0x3e: // MVI A - Move immediate register
-    state->a = opcode[1];
-    state->pc += 2;
-    return 7;
-  case 0x3f: // CMC - Complement Carry
-    state->cc.cy = !(state->cc.cy);
-    state->pc++;
-    return 4;
-  case 0x40: // MOV B,B = NOP
-  case 0x49: // MOV C,C = NOP
-  case 0x52: // MOV D,D = NOP
-  case 0x5b: // MOV E,E = NOP
-  case 0x64: // MOV H,H = NOP
-  case 0x6d: // MOV L,L = NOP
-  case 0x7f: // MOV A,A = NOP
-    state->pc++;
-    return 5;
-  case 0x41: // MOV B,C - Move register to register
-    state->b = state->c;
-    state->pc++;
-    return 5;
-  case 0x42: // MOV B,D - Move register to register
-    state->b = state->d;
-    state->pc++;
-    return 5;
-  case 0x43: // MOV B,E - Move register to register
-    state->b = state->e;
-    state->pc++;
-    return 5;
-  case 0x44: // MOV B,H - Move register to register
-    state->b = state->h;
-    state->pc++;
-    return 5;
-  case 0x45: // MOV B,L - Move register to register
-    state->b = state->l;
-    state->pc++;
-    return 5;
-  case 0x46: // MOV B,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->b = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x47: // MOV B,A - Move register to register
-    state->b = state->a;
-    state->pc++;
-    return 5;
-  case 0x48: // MOV C,B - Move register to register
-    state->c = state->b;
-    state->pc++;
-    return 5;
-    // case 0x49: // MOV C,C = NOP
-  case 0x4a: // MOV C,D - Move register to register
-    state->c = state->d;
-    state->pc++;
-    return 5;
-  case 0x4b: // MOV C,E - Move register to register
-    state->c = state->e;
-    state->pc++;
-    return 5;
-  case 0x4c: // MOV C,H - Move register to register
-    state->c = state->h;
-    state->pc++;
-    return 5;
-  case 0x4d: // MOV C,L - Move register to register
-    state->c = state->l;
-    state->pc++;
-    return 5;
-  case 0x4e: // MOV C,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->c = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x4f: // MOV C,A - Move register to register
-    state->c = state->a;
-    state->pc++;
-    return 5;
-  case 0x50: // MOV D,B - Move register to register
-    state->d = state->b;
-    state->pc++;
-    return 5;
-  case 0x51: // MOV D,C - Move register to register
-    state->d = state->c;
-    state->pc++;
-    return 5;
-    // case 0x52: // MOV D,D = NOP
-  case 0x53: // MOV D,E - Move register to register
-    state->d = state->e;
-    state->pc++;
-    return 5;
-  case 0x54: // MOV D,H - Move register to register
-    state->d = state->h;
-    state->pc++;
-    return 5;
-  case 0x55: // MOV D,L - Move register to register
-    state->d = state->l;
-    state->pc++;
-    return 5;
-  case 0x56: // MOV D,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->d = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x57: // MOV D,A - Move register to register
-    state->d = state->a;
-    state->pc++;
-    return 5;
-  case 0x58: // MOV E,B - Move register to register
-    state->e = state->b;
-    state->pc++;
-    return 5;
-  case 0x59: // MOV E,C - Move register to register
-    state->e = state->c;
-    state->pc++;
-    return 5;
-  case 0x5a: // MOV E,D - Move register to register
-    state->e = state->d;
-    state->pc++;
-    return 5;
-    //case 0x5b: // MOV E,E = NOP
-  case 0x5c: // MOV E,H - Move register to register
-    state->e = state->h;
-    state->pc++;
-    return 5;
-  case 0x5d: // MOV E,L - Move register to register
-    state->e = state->l;
-    state->pc++;
-    return 5;
-  case 0x5e: // MOV E,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->e = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x5f: // MOV E,A - Move register to register
-    state->e = state->a;
-    state->pc++;
-    return 5;
-  case 0x60: // MOV H,B - Move register to register
-    state->h = state->b;
-    state->pc++;
-    return 5;
-  case 0x61: // MOV H,C - Move register to register
-    state->h = state->c;
-    state->pc++;
-    return 5;
-  case 0x62: // MOV H,D - Move register to register
-    state->h = state->d;
-    state->pc++;
-    return 5;
-  case 0x63: // MOV H,E - Move register to register
-    state->h = state->e;
-    state->pc++;
-    return 5;
-    //case 0x64: // MOV H,H = NOP
-  case 0x65: // MOV H,L - Move register to register
-    state->h = state->l;
-    state->pc++;
-    return 5;
-  case 0x66: // MOV H,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->h = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x67: // MOV H,A - Move register to register
-    state->h = state->a;
-    state->pc++;
-    return 5;
-  case 0x68: // MOV L,B - Move register to register
-    state->l = state->b;
-    state->pc++;
-    return 5;
-  case 0x69: // MOV L,C - Move register to register
-    state->l = state->c;
-    state->pc++;
-    return 5;
-  case 0x6a: // MOV L,D - Move register to register
-    state->l = state->d;
-    state->pc++;
-    return 5;
-  case 0x6b: // MOV L,E - Move register to register
-    state->l = state->e;
-    state->pc++;
-    return 5;
-  case 0x6c: // MOV L,H - Move register to register
-    state->l = state->h;
-    state->pc++;
-    return 5;
-    //case 0x6d: // MOV L,L = NOP
-  case 0x6e: // MOV L,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->l = MEM_READ(offset);
-    state->pc++;
-    return 7;
-  case 0x6f: // MOV L,A - Move register to register
-    state->l = state->a;
-    state->pc++;
-    return 5;
-  case 0x70: // MOV M,B - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->b);
-    state->pc++;
-    return 7;
-  case 0x71: // MOV M,C - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->c);
-    state->pc++;
-    return 7;
-  case 0x72: // MOV M,D - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->d);
-    state->pc++;
-    return 7;
-  case 0x73: // MOV M,E - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->e);
-    state->pc++;
-    return 7;
-  case 0x74: // MOV M,H - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->h);
-    state->pc++;
-    return 7;
-  case 0x75: // MOV M,L - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->l);
-    state->pc++;
-    return 7;
-  case 0x76: // HLT - Halt
-    state->halted = true;
-    return 7;
-  case 0x77: // MOV M,A - Move register to memory
-    offset = (state->h << 8) | (state->l);
-    MEM_WRITE(offset, state->a);
-    state->pc++;
-    return 7;
-  case 0x78: // MOV A,B - Move register to register
-    state->a = state->b;
-    state->pc++;
-    return 5;
-  case 0x79: // MOV A,C - Move register to register
-    state->a = state->c;
-    state->pc++;
-    return 5;
-  case 0x7a: // MOV A,D - Move register to register
-    state->a = state->d;
-    state->pc++;
-    return 5;
-  case 0x7b: // MOV A,E - Move register to register
-    state->a = state->e;
-    state->pc++;
-    return 5;
-  case 0x7c: // MOV A,H - Move register to register
-    state->a = state->h;
-    state->pc++;
-    return 5;
-  case 0x7d: // MOV A,L - Move register to register
-    state->a = state->l;
-    state->pc++;
-    return 5;
-  case 0x7e: // MOV A,M - Move memory to register
-    offset = (state->h << 8) | (state->l);
-    state->a = MEM_READ(offset);
-    state->pc++;
-    return 7;
-    //case 0x7f: // MOV A,A = NOP
-  case 0x80: // ADD B - Add register to A
-    answer = (int) state->a + (int) state->b;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->b & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x81: // ADD C - Add register to A
-    answer = (int) state->a + (int) state->c;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->c & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x82: // ADD D - Add register to A
-    answer = (int) state->a + (int) state->d;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->d & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x83: // ADD E - Add register to A
-    answer = (int) state->a + (int) state->e;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->e & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x84: // ADD H - Add register to A
-    answer = (int) state->a + (int) state->h;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->h & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x85: // ADD L - Add register to A
-    answer = (int) state->a + (int) state->l;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->l & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x86: // ADD M - Add memory to A
-    offset = (state->h << 8) | (state->l);
-    answer = (int) state->a + MEM_READ(offset);
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (MEM_READ(offset) & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 7;
-  case 0x87: // ADD A - Add register to A
-    answer = (int) state->a + (int) state->a;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->a & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x88: // ADC B - Add register to A with carry
-    answer = (int) state->a + (int) state->b + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->b & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x89: // ADC C - Add register to A with carry
-    answer = (int) state->a + (int) state->c + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->c & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x8a: // ADC D - Add register to A with carry
-    answer = (int) state->a + (int) state->d + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->d & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x8b: // ADC E - Add register to A with carry
-    answer = (int) state->a + (int) state->e + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->e & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x8c: // ADC H - Add register to A with carry
-    answer = (int) state->a + (int) state->h + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->h & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x8d: // ADC L - Add register to A with carry
-    answer = (int) state->a + (int) state->l + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->l & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x8e: // ADC M - Add memory to A with carry
-    offset = (state->h << 8) | (state->l);
-    answer = (int) state->a + (int) MEM_READ(offset) + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (MEM_READ(offset) & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 7;
-  case 0x8f: // ADC A - Add register to A with carry
-    answer = (int) state->a + (int) state->a + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (state->a & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x90: // SUB B - Subtract register from A
-    answer = (int) state->a + (int) (~state->b & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->b & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x91: // SUB C - Subtract register from A
-    answer = (int) state->a + (int) (~state->c & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->c & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x92: // SUB D - Subtract register from A
-    answer = (int) state->a + (int) (~state->d & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->d & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x93: // SUB E - Subtract register from A
-    answer = (int) state->a + (int) (~state->e & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->e & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x94: // SUB H - Subtract register from A
-    answer = (int) state->a + (int) (~state->h & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->h & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x95: // SUB L - Subtract register from A
-    answer = (int) state->a + (int) (~state->l & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->l & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x96: // SUB M - Subtract memory from A
-    offset = (state->h << 8) | (state->l);
-    answer = (int) state->a + (int) (~MEM_READ(offset) & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~MEM_READ(offset) & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 7;
-  case 0x97: // SUB A - Subtract register from A
-    answer = (int) state->a + (int) (~state->a & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->a & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x98: // SBB B - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->b & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->b & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x99: // SBB C - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->c & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->c & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x9a: // SBB D - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->d & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->d & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x9b: // SBB E - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->e & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->e & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x9c: // SBB H - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->h & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->h & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x9d: // SBB L - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->l & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->l & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0x9e: // SBB M - Subtract memory from A with borrow
-    offset = (state->h << 8) | (state->l);
-    answer = (int) state->a + (int) (~MEM_READ(offset) & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~MEM_READ(offset) & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 7;
-  case 0x9f: // SBB A - Subtract register from A with borrow
-    answer = (int) state->a + (int) (~state->a & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->a & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc++;
-    return 4;
-  case 0xa0: // ANA B - Logical AND register with accumulator
-    state->a &= state->b;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa1: // ANA C - Logical AND register with accumulator
-    state->a &= state->c;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa2:  // ANA D - Logical AND register with accumulator
-    state->a &= state->d;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa3:  // ANA E - Logical AND register with accumulator
-    state->a &= state->e;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa4:  // ANA H - Logical AND register with accumulator
-    state->a &= state->h;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa5:  // ANA L - Logical AND register with accumulator
-    state->a &= state->l;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa6: // ANA M - Logical AND memory with accumulator
-    offset = (state->h << 8) | (state->l);
-    state->a &= MEM_READ(offset);
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 7;
-  case 0xa7: // ANA A - Logical AND register with accumulator
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa8: // XRA B - Logical exclusive-OR register with accumulator
-    state->a ^= state->b;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xa9: // XRA C - Logical exclusive-OR register with accumulator
-    state->a ^= state->c;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xaa: // XRA D - Logical exclusive-OR register with accumulator
-    state->a ^= state->d;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xab: // XRA E - Logical exclusive-OR register with accumulator
-    state->a ^= state->e;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xac: // XRA H - Logical exclusive-OR register with accumulator
-    state->a ^= state->h;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xad: // XRA L - Logical exclusive-OR register with accumulator
-    state->a ^= state->l;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xae: // XRA M - Logical exclusive-OR register with memory
-    offset = (state->h << 8) | (state->l);
-    state->a ^= MEM_READ(offset);
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 7;
-  case 0xaf: // XRA A - Logical exclusive-OR register with accumulator
-    state->a ^= state->a;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb0: // ORA B - Logical OR register with accumulator
-    state->a |= state->b;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb1: // ORA C - Logical OR register with accumulator
-    state->a |= state->c;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb2: // ORA D - Logical OR register with accumulator
-    state->a |= state->d;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb3: // ORA E - Logical OR register with accumulator
-    state->a |= state->e;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb4: // ORA H - Logical OR register with accumulator
-    state->a |= state->h;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb5: // ORA L - Logical OR register with accumulator
-    state->a |= state->l;
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb6: // ORA M - Logical OR register with memory
-    offset = (state->h << 8) | (state->l);
-    state->a |= MEM_READ(offset);
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 7;
-  case 0xb7: // ORA A - Logical OR register with accumulator
-    state->cc.z = ((state->a & 0xff) == 0);
-    state->cc.s = ((state->a & 0x80) != 0);
-    state->cc.p = Parity(state->a & 0xff);
-    state->cc.cy = false;
-    state->cc.ac = false;
-    state->pc++;
-    return 4;
-  case 0xb8: // CMP B - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->b & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->b & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xb9: // CMP C - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->c & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->c & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xba: // CMP D - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->d & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->d & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xbb: // CMP E - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->e & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->e & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xbc: // CMP H - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->h & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->h & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xbd: // CMP L - Compare register with accumulator
-    answer = (int) state->a + (int) (~state->l & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->l & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xbe: // CMP M - Compare memory with accumulator
-    offset = (state->h << 8) | (state->l);
-    answer = (int) state->a + (int) (~MEM_READ(offset) & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~state->l & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc++;
-    return 4;
-  case 0xbf: // CMP A - Compare register with accumulator
-    state->cc.z = true;
-    state->cc.s = false;
-    state->cc.ac = ((state->a & 0x0f) + (~state->a & 0x0f) + 1 > 0x0f);
-    state->cc.cy = true;
-    state->cc.p = Parity(0x00);
-    state->pc++;
-    return 4;
-  case 0xc0: // RNZ - Return if not zero
-    if (state->cc.z == false) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xc1: // POP B - Pop data off stack
-    state->c = MEM_READ(state->sp);
-    state->b = MEM_READ(state->sp + 1);
-    state->sp += 2;
-    state->pc++;
-    return 10;
-  case 0xc2: // JNZ - Jump if not zero
-    if (state->cc.z == false)  state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xc3: // JMP - Jump
-  case 0xcb:
-    state->pc = (opcode[2] << 8) | opcode[1];
-    return 10;
-  case 0xc4: // CNZ - Call if no zero
-    if (state->cc.z == false) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-  case 0xc5: // PUSH B - Push data onto stack
-    MEM_WRITE(state->sp - 1, state->b);
-    MEM_WRITE(state->sp - 2, state->c);
-    state->sp -= 2;
-    state->pc++;
-    return 11;
-  case 0xc6: // ADI - Add immediate to A
-    answer = (int) state->a + (int) opcode[1];
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (opcode[1] & 0x0f) > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc += 2;
-    return 7;
-  case 0xc7: // RST - call subroutine at specified location
-  case 0xcf:
-  case 0xd7:
-  case 0xdf:
-  case 0xe7:
-  case 0xef:
-  case 0xf7:
-  case 0xff:
-    if (!handling_interrupt) state->pc++;
-    MEM_WRITE(state->sp - 2, state->pc & 0xff);
-    MEM_WRITE(state->sp - 1, state->pc >> 8);
-    state->sp -= 2;
-    state->pc = (int) current_opcode & 0x38; // not opcode[0] since may be servicing an interrupt
-    return 11;
-  case 0xc8: // RZ - Return if zero
-    if (state->cc.z) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xc9: // RET - Return
-  case 0xd9:
-    state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-    state->sp += 2;
-    return 10;
-  case 0xca: // JZ - Jump if zero
-    if (state->cc.z) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-    //case 0xcb: Duplicate of JMP
-  case 0xcc: // CZ - Call on zero
-    if (state->cc.z) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-  case 0xcd: // CALL - Call
-  case 0xdd:
-  case 0xed:
-  case 0xfd:
-    offset = state->pc + 3;
-    MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-    MEM_WRITE(state->sp - 2, (offset & 0xff));
-    state->sp -= 2;
-    state->pc = (opcode[2] << 8) | opcode[1];
-    return 17;
-  case 0xce: // ACI - Add immediate to A with carry
-    answer = (int) state->a + (int) opcode[1] + (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (opcode[1] & 0x0f) + state->cc.cy > 0x0f);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc += 2;
-    return 7;
-    //case 0xcf: Restart
-  case 0xd0: // RC - Return if no carry
-    if (state->cc.cy == false) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xd1: // POP D - Pop data off stack
-    state->e = MEM_READ(state->sp);
-    state->d = MEM_READ(state->sp + 1);
-    state->sp += 2;
-    state->pc++;
-    return 10;
-  case 0xd2: // JNC - Jump if no carry
-    if (state->cc.cy == false) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xd3: // OUT - output to port
-    state->port_op = current_opcode;
-    state->port = opcode[1];
-    state->pc += 2;
-    return 10;
-  case 0xd4: // CNC - Call if no carry
-    if (state->cc.cy == false) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-  case 0xd5: // PUSH D - Push data onto stack
-    MEM_WRITE(state->sp - 1, state->d);
-    MEM_WRITE(state->sp - 2, state->e);
-    state->sp -= 2;
-    state->pc++;
-    return 11;
-  case 0xd6: // SUI - Subtract immediate from A
-    answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~opcode[1] & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc += 2;
-    return 7;
-    //case 0xd7: Restart
-  case 0xd8: // RC - Return if carry
-    if (state->cc.cy) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-    //case 0xd9: Duplication of RET
-  case 0xda: // JC - Jump if carry
-    if (state->cc.cy) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xdb: // IN - Input from port
-    state->port_op = current_opcode;
-    state->port = opcode[1];
-    state->pc += 2;
-    return 10;
-  case 0xdc: // CC - Call if carry
-    if (state->cc.cy) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-    //case 0xdd: Duplicate of CALL
-  case 0xde: // SBI - Subtract immediate from A with borrow
-    answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
-    answer -= (int) state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~opcode[1] & 0x0f) + 1 + state->cc.cy > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->a = answer & 0xff;
-    state->pc += 2;
-    return 7;
-    //case 0xdf: Restart
-  case 0xe0: // RPO - Return if parity odd
-    if (state->cc.p == false) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xe1: // POP H - Pop data off stack
-    state->l = MEM_READ(state->sp);
-    state->h = MEM_READ(state->sp + 1);
-    state->sp += 2;
-    state->pc++;
-    return 10;
-  case 0xe2: // JPO - Jump if parity odd
-    if (state->cc.p == false) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xe3: // XTHL - Exchange stack
-    offset = (state->h << 8) | (state->l);
-    state->l = MEM_READ(state->sp);
-    state->h = MEM_READ(state->sp + 1);
-    MEM_WRITE(state->sp + 1, offset >> 8);
-    MEM_WRITE(state->sp, offset & 0xff);
-    state->pc++;
-    return 18;
-  case 0xe4: // CPO - Call if parity odd
-    if (state->cc.p == false) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-  case 0xe5: // PUSH H - Push data onto stack
-    MEM_WRITE(state->sp - 1, state->h);
-    MEM_WRITE(state->sp - 2, state->l);
-    state->sp -= 2;
-    state->pc++;
-    return 11;
-  case 0xe6: // ANI - AND immediate with accumulator
-    state->a &= opcode[1];
-    state->cc.cy = false;
-    state->cc.z = (state->a == 0x00);
-    state->cc.s = ((state->a & 0x80) != 0x00);
-    state->cc.p = Parity(state->a);
-    state->pc += 2;
-    return 7;
-    //case 0xe7: Restart
-  case 0xe8: // RPE - Return if parity even
-    if (state->cc.p) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xe9: // PCHL - Load program counter
-    state->pc = (state->h << 8) | state->l;
-    return 5;
-  case 0xea: // JPE - Jump if parity even
-    if (state->cc.p) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xeb: // XCHG - Exchange registers
-    offset = (state->h << 8) | (state->l);
-    state->h = state->d;
-    state->l = state->e;
-    state->d = offset >> 8;
-    state->e = offset & 0xff;
-    state->pc++;
-    return 4;
-  case 0xec: // CPC - Call if parity even
-    if (state->cc.p) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-    //case 0xed: Duplicate of CALL
-  case 0xee: // XRI - Exclusive-OR immediate with accumulator
-    state->a ^= opcode[1];
-    state->cc.cy = false;
-    state->cc.z = (state->a == 0x00);
-    state->cc.s = ((state->a & 0x80) != 0x00);
-    state->cc.p = Parity(state->a);
-    state->pc += 2;
-    return 7;
-    //case 0xef: Restart
-  case 0xf0: // RP - Return if plus
-    if (state->cc.s == false) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xf1: // POP PSW - Pop data off stack
-    state->cc.s = ((MEM_READ(state->sp) & 0x80) > 0);
-    state->cc.z = ((MEM_READ(state->sp) & 0x40) > 0);
-    state->cc.ac = ((MEM_READ(state->sp) & 0x10) > 0);
-    state->cc.p = ((MEM_READ(state->sp) & 0x04) > 0);
-    state->cc.cy = ((MEM_READ(state->sp) & 0x01) > 0);
-    state->a = MEM_READ(state->sp + 1);
-    state->sp += 2;
-    state->pc++;
-    return 10;
-  case 0xf2: // JP - Jump if positive
-    if (state->cc.s == false) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xf3: // DI - Disable interrupts
-    state->int_enable = false;
-    state->pc++;
-    return 4;
-  case 0xf4: // CP - Call if plus
-    if (state->cc.s == false) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-  case 0xf5: // PUSH PSW - Push data onto stack
-    answer = state->cc.cy + 0x10;
-    answer += state->cc.p << 2;
-    answer += state->cc.ac << 4;
-    answer += state->cc.z << 6;
-    answer += state->cc.s << 7;
-    MEM_WRITE(state->sp - 2, answer & 0xff);
-    MEM_WRITE(state->sp - 1, state->a);
-    state->sp -= 2;
-    state->pc++;
-    return 11;
-  case 0xf6: // ORI - OR immediate with accumulator
-    state->a |= opcode[1];
-    state->cc.cy = false;
-    state->cc.z = (state->a == 0x00);
-    state->cc.s = ((state->a & 0x80) != 0x00);
-    state->cc.p = Parity(state->a);
-    state->pc += 2;
-    return 7;
-    //case 0xf7: Restart
-  case 0xf8: // RM - Return if minus
-    if (state->cc.s) {
-      state->pc = MEM_READ(state->sp) | (MEM_READ(state->sp + 1) << 8);
-      state->sp += 2;
-    } else state->pc++;
-    return 11;
-  case 0xf9: // SPHL - Load SP from H and L
-    state->sp = (state->h << 8) | (state->l);
-    state->pc++;
-    return 5;
-  case 0xfa: // JM - Jump if minus
-    if (state->cc.s) state->pc = (opcode[2] << 8) | opcode[1];
-    else state->pc += 3;
-    return 10;
-  case 0xfb: // EI - Enable interrupts
-    state->int_enable = true;
-    state->pc++;
-    return 4;
-  case 0xfc: // CM - Call if minus
-    if (state->cc.s) {
-      offset = state->pc + 3;
-      MEM_WRITE(state->sp - 1, (offset >> 8) & 0xff);
-      MEM_WRITE(state->sp - 2, (offset & 0xff));
-      state->sp -= 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else state->pc += 3;
-    return 11;
-    //case 0xfd: Duplicate of CALL
-  case 0xfe: // CPI - Compare immediate with accumulator
-    answer = (int) state->a + (int) (~opcode[1] & 0xff) + 1;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.ac = ((state->a & 0x0f) + (~opcode[1] & 0x0f) + 1 > 0x0f);
-    state->cc.cy = (answer <= 0xff);
-    state->cc.p = Parity(answer & 0xff);
-    state->pc += 2;
-    return 7;
-    //case 0xff: RST 7
   }
 }
+
+int SingleStep8080(State8080 *state, Bus8080 *bus) { // return the number of machine cycles
+  int cycles;
+  WakeUp8080(state);
+  if (state->halted) return 0;
+  cycles = state->profile ? ProfileExecute8080(state, bus) : Execute8080(state, bus);
+  state->cycles += cycles;
+  state->instructions++;
+  return cycles;
+}
+
+// Run until the cycle budget is used up, an IN or OUT instruction is
+// waiting to be handled (port_op is set), or the processor halts.
+// The registers are kept in a local copy of the state for the
+// duration, and written back before returning.  If there is a block
+// cache, pre-decoded blocks are used except to service an interrupt,
+// or when profiling.
+
+Stop8080 Run8080(State8080 *state, Bus8080 *bus, int cycle_budget) {
+  State8080 cpu = *state;
+  BlockCache8080 *cache = cpu.cache;
+  Stop8080 stop = STOP_BUDGET;
+  int cycles = 0;
+  int ops = 0;
+  int i;
+  WakeUp8080(&cpu);
+  while (cycles < cycle_budget && !cpu.halted) {
+    if (cache && !cpu.profile && !(cpu.interrupt && cpu.int_enable)) {
+      Block8080 *block = cache->block[cpu.pc];
+      if (block == NULL) block = BuildBlock8080(cache, bus, cpu.pc);
+      if (block) { // the block may be thrown away by a write from within
+	int count = block->count;
+	MicroOp8080 *op = block->op;
+	cache->flushed = false;
+	for (i=0; i<count; i++) {
+	  cycles += op[i].handler(&cpu, bus, op[i].opcode);
+	  ops++;
+	  if (cycles >= cycle_budget || cache->flushed) break; // block and op are gone if flushed
+	}
+	if (cpu.port_op) {
+	  stop = STOP_PORT;
+	  break;
+	}
+	continue;
+      }
+    }
+    cycles += cpu.profile ? ProfileExecute8080(&cpu, bus) : Execute8080(&cpu, bus);
+    ops++;
+    if (cpu.port_op) {
+      stop = STOP_PORT;
+      break;
+    }
+  }
+  if (cpu.halted) stop = STOP_HALT;
+  cpu.cycles += cycles;
+  cpu.instructions += ops;
+  *state = cpu;
+  return stop;
+}
@@ -33,6 +33,9 @@
  * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
  */
 
+#ifndef _8080_HPP
+#define _8080_HPP
+
 typedef struct ConditionCodes {
   bool z;
   bool s;
@@ -41,6 +44,27 @@ typedef struct ConditionCodes {
   bool ac;
 } ConditionCodes;
 
+// The sign, zero, parity and auxiliary carry flags are evaluated
+// lazily: the core records the result (or, for the auxiliary carry,
+// the operands) and sets a bit in 'pending' instead of updating cc.
+// SyncFlags8080 brings cc up to date.
+
+#define PENDING_SZP 0x01 // s, z and p are to be found from flag_res
+#define PENDING_AC  0x02 // ac is to be found from flag_ac
+
+struct BlockCache8080; // pre-decoded basic blocks, private to 8080.cpp
+
+// If the profiler is enabled, each instruction executed is counted
+// with its cycles against its address and its op code.  An interrupt
+// is counted as its RST at the address it interrupts.
+
+typedef struct Profile8080 {
+  unsigned long long count[0x10000];
+  unsigned long long cycles[0x10000];
+  unsigned long long op_count[256];
+  unsigned long long op_cycles[256];
+} Profile8080;
+
 typedef struct State8080 {
   uint8_t a;
   uint8_t b;
@@ -52,13 +76,70 @@ typedef struct State8080 {
   uint16_t sp;
   uint16_t pc;
   struct  ConditionCodes cc;
+  uint8_t pending = 0;
+  uint8_t flag_res = 0;
+  uint16_t flag_ac = 0;
   uint8_t port;
   uint8_t port_op;
   bool int_enable;
   uint8_t interrupt;
   bool halted;
+  unsigned long long cycles = 0; // machine cycles executed since start up
+  unsigned long long instructions = 0; // and instructions
+  struct BlockCache8080 *cache = NULL; // set up by EnableCache8080
+  Profile8080 *profile = NULL; // set up by EnableProfile8080
 } State8080;
 
+// The memory bus is a table of 256 pages of 256 bytes.  Each page has
+// a pointer for reads and one for writes, so that a plain access is a
+// single indexed load or store.  The attributes set by MapPages8080
+// decide where these point: RAM reads and writes the memory array,
+// ROM ignores writes (they go to a scratch page) and the VDU ignores
+// reads (they come from a page of 0xff).  If a page is given a
+// handler its pointers are NULL and every access is passed to the
+// handler instead, with byte < 0 for a read.  A block cache must be
+// flushed if the pages are re-mapped after the processor has run.
+// Every write marks its line of 64 bytes as dirty, so that the owner
+// of the bus can find out what has changed and clear the marks.
+
+#define PAGE_ROM 0x00 // read only, the default
+#define PAGE_RAM 0x01 // read and write
+#define PAGE_VDU 0x02 // write only, reads give 0xff
+
+typedef uint8_t (*PageHandler8080)(void *context, uint16_t address, int byte);
+
+typedef struct Bus8080 {
+  uint8_t *read[256];
+  uint8_t *write[256];
+  uint8_t attr[256];
+  PageHandler8080 handler[256];
+  void *context[256];
+  uint8_t *memory; // the 64K array behind the pages
+  uint8_t blank[256];
+  uint8_t scratch[256];
+  uint8_t dirty[1024]; // one for each line of 64 bytes, all set to begin with
+} Bus8080;
+
+void InitBus8080(Bus8080 *bus, uint8_t *memory);
+void MapPages8080(Bus8080 *bus, int start, int end, uint8_t attr);
+void SetPageHandler8080(Bus8080 *bus, int page, PageHandler8080 handler, void *context);
+void WriteMemory8080(State8080 *state, Bus8080 *bus, uint16_t address, uint8_t byte);
+
+// Reasons for Run8080 to return
+
+typedef enum {
+  STOP_BUDGET, // the cycle budget has been used up
+  STOP_PORT,   // an IN or OUT instruction is waiting (see port_op)
+  STOP_HALT    // the processor is halted
+} Stop8080;
+
 void WriteStatus8080(FILE *fp, State8080 *state);
 void Reset8080(State8080 *state);
-int SingleStep8080(State8080 *state, uint8_t *memory);
+void SyncFlags8080(State8080 *state);
+int SingleStep8080(State8080 *state, Bus8080 *bus);
+Stop8080 Run8080(State8080 *state, Bus8080 *bus, int cycle_budget);
+void EnableCache8080(State8080 *state, bool enable);
+void FlushCache8080(State8080 *state);
+void EnableProfile8080(State8080 *state, bool enable);
+
+#endif
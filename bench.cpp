@@ -0,0 +1,217 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Benchmarks for the emulator core
+ * Each workload is set up (the ROMs booted, a tape loaded and keys
+ * typed) and then run for a number of cycles several times over,
+ * timing each repeat.  For each workload the host time per
+ * instruction and the emulated clock rate are reported, with the
+ * spread over the repeats.  The Triton's effective clock rate is
+ * 800kHz (one machine cycle is 1.25uS).
+ */
+
+#include "machine.hpp"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+// A synthetic mix of moves, arithmetic, memory accesses, calls and
+// jumps, run from 0x1600.  It sweeps a 256 byte buffer at 0x1800.
+
+static const uint8_t mix_kernel[] = {
+  0x31, 0x00, 0x20, // 1600 LXI SP,2000
+  0x21, 0x00, 0x18, // 1603 LXI H,1800
+  0x0e, 0x00,       // 1606 MVI C,00
+  0x7e,             // 1608 MOV A,M
+  0x81,             // 1609 ADD C
+  0x1f,             // 160A RAR
+  0xa8,             // 160B XRA B
+  0x77,             // 160C MOV M,A
+  0x47,             // 160D MOV B,A
+  0xcd, 0x20, 0x16, // 160E CALL 1620
+  0x23,             // 1611 INX H
+  0x0d,             // 1612 DCR C
+  0xc2, 0x08, 0x16, // 1613 JNZ 1608
+  0xc3, 0x03, 0x16, // 1616 JMP 1603
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 1619-161F
+  0xe5,             // 1620 PUSH H
+  0xd5,             // 1621 PUSH D
+  0xeb,             // 1622 XCHG
+  0x29,             // 1623 DAD H
+  0xeb,             // 1624 XCHG
+  0xd1,             // 1625 POP D
+  0xe1,             // 1626 POP H
+  0xfe, 0x80,       // 1627 CPI 80
+  0xd0,             // 1629 RNC
+  0x3c,             // 162A INR A
+  0xc9              // 162B RET
+};
+
+#define MIX_START 0x1600
+
+// The keys are typed with type_keys (see machine.cpp), as by the
+// headless runner, so menus need time to appear.
+
+typedef struct Workload {
+  const char *name;
+  const char *tape_file; // or NULL
+  const char *keys;      // or NULL to run the synthetic kernel
+} Workload;
+
+static const Workload workloads[] = {
+  {"basic", NULL,
+   "j\\w\n10 for i=1 to 1000\n20 b=i/7*3+i/5-b\n30 next i\n40 print b\n50 goto 10\nrun\n"},
+  {"trap", NULL,
+   "g\\wc000\n\\w\\w\\w\\w\\w\\w\\w\\w3\\w\\we000\n\\w\\wffff\n\\w\\wn"},
+  {"invaders", "INVADERS_TAPE",
+   "i\\winvaders\n\\w\\wg\\w1602\n\\w\\w"},
+  {"mix", NULL, NULL}
+};
+
+typedef struct Result {
+  double ns_per_op;
+  double mhz;
+} Result;
+
+// Set up a workload and time it over a number of repeats.  Returns
+// false if the processor halted.
+
+bool run_workload(const Workload *load, bool cache, int cycles, int repeats, vector<Result> &results) {
+  TritonMachine *machine = new TritonMachine();
+  bool ok = true;
+  int i;
+  if (load->tape_file) machine->tape_file = load->tape_file;
+  machine->load_roms(NULL);
+  EnableCache8080(&machine->state, cache);
+  if (load->keys) {
+    machine->run(BOOT_CYCLES);
+    type_keys(machine, load->keys, [machine](unsigned long long cycles) { return machine->run(cycles); });
+  } else {
+    memcpy(&machine->memory[MIX_START], mix_kernel, sizeof(mix_kernel));
+    machine->state.pc = MIX_START;
+  }
+  for (i=0; i<repeats && ok; i++) {
+    unsigned long long ops = machine->state.instructions;
+    unsigned long long start = machine->state.cycles;
+    auto t0 = chrono::steady_clock::now();
+    ok = machine->run(cycles);
+    auto t1 = chrono::steady_clock::now();
+    double secs = chrono::duration<double>(t1 - t0).count();
+    Result result;
+    result.ns_per_op = 1e9 * secs / (machine->state.instructions - ops);
+    result.mhz = 1e-6 * (machine->state.cycles - start) / secs;
+    results.push_back(result);
+  }
+  delete machine;
+  return ok;
+}
+
+// Mean and standard deviation
+
+void mean_sd(const vector<double> &x, double *mean, double *sd) {
+  double sum = 0, sum2 = 0;
+  size_t i, n = x.size();
+  for (i=0; i<n; i++) sum += x[i];
+  *mean = sum / n;
+  for (i=0; i<n; i++) sum2 += (x[i] - *mean) * (x[i] - *mean);
+  *sd = n > 1 ? sqrt(sum2 / (n - 1)) : 0;
+}
+
+int main(int argc, char** argv) {
+  bool cache = true;
+  int cycles = 100 * CYCLES_PER_SECOND;
+  int repeats = 5;
+  char *pend;
+  int c, i, j;
+  size_t k;
+
+  opterr = 0;
+  while ((c = getopt(argc, argv, "hc:nr:")) != -1) switch (c) {
+    case 'c': cycles = strtoul(optarg, &pend, 0); break;
+    case 'n': cache = false; break;
+    case 'r': repeats = strtoul(optarg, &pend, 0); break;
+    case 'h': case '?':
+      printf("Triton emulator core benchmarks\n");
+      printf("usage: %s [-h|-?] [-c cycles] [-n] [-r repeats] [workload(s)]\n", argv[0]);
+      printf("-h or -? (help) : print this help\n");
+      printf("-c sets the number of cycles in each repeat, defaults to 80000000 (100 seconds)\n");
+      printf("-n runs without the block cache\n");
+      printf("-r sets the number of repeats, defaults to 5\n");
+      printf("The workloads are:");
+      for (k=0; k<sizeof(workloads)/sizeof(workloads[0]); k++) printf(" %s", workloads[k].name);
+      printf("\n");
+    default:
+      exit(0);
+    }
+
+  for (i=optind; i<argc; i++) {
+    for (k=0; k<sizeof(workloads)/sizeof(workloads[0]); k++) if (strcmp(argv[i], workloads[k].name) == 0) break;
+    if (k == sizeof(workloads)/sizeof(workloads[0])) {
+      fprintf(stderr, "%s: no workload called %s (try -h)\n", argv[0], argv[i]);
+      exit(1);
+    }
+  }
+
+  if (repeats < 1) repeats = 1;
+  printf("%-10s %8s %8s %8s %8s %8s %8s\n", "workload", "ns/op", "+/-", "min", "MHz", "+/-", "x real");
+  for (k=0; k<sizeof(workloads)/sizeof(workloads[0]); k++) {
+    const Workload *load = &workloads[k];
+    bool selected = (optind == argc);
+    for (i=optind; i<argc; i++) if (strcmp(argv[i], load->name) == 0) selected = true;
+    if (!selected) continue;
+    vector<Result> results;
+    vector<double> ns, mhz;
+    double ns_mean, ns_sd, mhz_mean, mhz_sd;
+    if (!run_workload(load, cache, cycles, repeats, results)) {
+      printf("%-10s halted\n", load->name);
+      continue;
+    }
+    for (j=0; j<(int)results.size(); j++) {
+      ns.push_back(results[j].ns_per_op);
+      mhz.push_back(results[j].mhz);
+    }
+    mean_sd(ns, &ns_mean, &ns_sd);
+    mean_sd(mhz, &mhz_mean, &mhz_sd);
+    printf("%-10s %8.2f %8.2f %8.2f %8.1f %8.1f %8.0f\n", load->name, ns_mean, ns_sd,
+	   *min_element(ns.begin(), ns.end()), mhz_mean, mhz_sd, mhz_mean / 0.8);
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Lock-free hand-offs between the emulation thread and the display
+ * thread.  A triple buffer carries the latest frame one way, so that
+ * neither side ever waits for the other, and a single producer,
+ * single consumer queue carries key presses and commands the other.
+ */
+
+#ifndef _HANDOFF_HPP
+#define _HANDOFF_HPP
+
+#include <atomic>
+
+// Three copies of T: one being written, one being read and one in
+// the middle.  The writer fills back() and swaps it with the middle
+// with publish(); the reader swaps the middle with its own copy with
+// update(), if the middle is fresh.  A frame the reader misses is
+// simply overwritten.
+
+template <typename T> class TripleBuffer {
+public:
+  T *back() { return &buffer[write]; }
+  void publish() {
+    write = middle.exchange(write | FRESH, std::memory_order_acq_rel) & ~FRESH;
+  }
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+    read = middle.exchange(read, std::memory_order_acq_rel) & ~FRESH;
+    return true;
+  }
+  const T *front() const { return &buffer[read]; }
+private:
+  static const int FRESH = 0x4; // set in middle when it has been published but not read
+  T buffer[3] = {};
+  std::atomic<int> middle{1};
+  int write = 0; // only touched by the writer
+  int read = 2;  // only touched by the reader
+};
+
+// A ring of N items (N a power of two) with one thread pushing and
+// another popping.  push() returns false if the ring is full and
+// pop() returns false if it is empty.
+
+template <typename T, unsigned N> class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+public:
+  bool push(const T &item) {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) return false;
+    ring[t % N] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  bool pop(T &item) {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    item = ring[h % N];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+private:
+  T ring[N];
+  std::atomic<unsigned> head{0}; // next to pop, written by the consumer
+  std::atomic<unsigned> tail{0}; // next to push, written by the producer
+};
+
+#endif
@@ -0,0 +1,336 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Headless batch runner for the Transam Triton emulator
+ * Each job boots the ROMs, attaches a tape file, types a keystroke
+ * script, and runs for a number of cycles or until the processor
+ * halts or reaches a given PC.  The VDU memory and registers are then
+ * printed.  Jobs are taken from a work queue by one thread per core.
+ */
+
+#include "machine.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <unistd.h>
+
+using namespace std;
+
+typedef struct Job {
+  string tape_file; // may be empty
+  string key_file;  // may be empty
+  string result;
+  string profile;
+} Job;
+
+typedef struct Settings {
+  uint16_t mem_top = MEM_TOP_DEFAULT;
+  char *user_rom = NULL;
+  unsigned long long cycles = 10 * CYCLES_PER_SECOND;
+  int stop_pc = -1; // no PC condition
+  char *profile_file = NULL;
+  char *load_file = NULL; // start from a saved state instead of booting
+  char *save_file = NULL; // save the state at the end
+  char *replay_file = NULL; // replay an input log instead of booting and typing keys
+  char *record_file = NULL; // record the input
+  bool fast_tape = false; // copy programs from tape in one go
+  bool fast_print = false; // print characters in one go
+  char *printer_file = NULL; // the printer output, instead of stdout
+  int tape_program = 0; // wind the tape to this program first
+  SymbolTable symbols;
+} Settings;
+
+class WorkQueue {
+public:
+  vector<Job> jobs;
+  size_t next = 0;
+  mutex lock;
+  Job *take();
+};
+
+// Hand out the next job, or NULL if there are none left
+
+Job *WorkQueue::take() {
+  lock_guard<mutex> guard(lock);
+  if (next >= jobs.size()) return NULL;
+  return &jobs[next++];
+}
+
+// Run for up to a number of cycles, stopping early if the processor
+// halts or arrives at the PC condition.  Returns the reason for
+// stopping.
+
+const char *run_for(TritonMachine *machine, const Settings *settings, unsigned long long cycles) {
+  unsigned long long end = machine->state.cycles + cycles;
+  if (settings->stop_pc < 0) {
+    while (machine->state.cycles < end) {
+      unsigned long long left = end - machine->state.cycles;
+      if (!machine->run(left > CYCLES_PER_SECOND ? CYCLES_PER_SECOND : left)) return "halted";
+    }
+  } else { // one instruction at a time
+    while (machine->state.cycles < end) {
+      if (machine->state.pc == settings->stop_pc) return "pc";
+      if (!machine->run(1)) return "halted";
+    }
+  }
+  return NULL;
+}
+
+// Replay the key, interrupt and reset events from an input log, each
+// at the cycle it was recorded at (the tape reads are replayed as they
+// happen)
+
+const char *replay(TritonMachine *machine, const Settings *settings, InputLog &log) {
+  const char *stop;
+  size_t i;
+  for (i=0; i<log.events.size(); i++) {
+    const InputEvent &event = log.events[i];
+    if (event.type == 't') continue;
+    if (event.cycles > machine->state.cycles && (stop = run_for(machine, settings, event.cycles - machine->state.cycles))) return stop;
+    InputLog::apply(machine, event);
+  }
+  return NULL;
+}
+
+// The screen as text, from the top row down, with anything that is
+// not printable shown as a dot
+
+string vdu_text(TritonMachine *machine) {
+  string text;
+  int row, col;
+  for (row=0; row<16; row++) {
+    for (col=0; col<64; col++) {
+      int i = (64 * (machine->io.vdu_startrow + row) + col) % 1024;
+      uint8_t c = machine->memory[0x1000 + i] & 0x7f;
+      text += (c >= 0x20 && c < 0x7f) ? (char)c : '.';
+    }
+    text += '\n';
+  }
+  return text;
+}
+
+void run_job(Job *job, const Settings *settings) {
+  TritonMachine *machine = new TritonMachine(settings->mem_top);
+  ostringstream out;
+  string keys;
+  InputLog replay_log, record_log;
+  const char *stop = NULL;
+  char *status;
+  size_t size;
+  machine->load_roms(settings->user_rom);
+  if (settings->load_file && !machine->load_state(settings->load_file)) {
+    out << "unable to load state from " << settings->load_file << "\n";
+  }
+  if (!job->tape_file.empty() || !settings->load_file) machine->tape_file = job->tape_file;
+  machine->fast_tape = settings->fast_tape;
+  machine->fast_print = settings->fast_print;
+  if (settings->printer_file && !machine->printer.open(settings->printer_file)) {
+    out << "unable to open " << settings->printer_file << " for the printer\n";
+  }
+  if (settings->tape_program != 0 && !machine->seek_tape(settings->tape_program)) {
+    out << "no program " << settings->tape_program << " on the tape\n";
+  }
+  if (settings->profile_file) EnableProfile8080(&machine->state, true);
+  if (!job->key_file.empty()) {
+    ifstream fs(job->key_file);
+    if (fs.is_open()) keys.assign(istreambuf_iterator<char>(fs), istreambuf_iterator<char>());
+    else out << "unable to open key file " << job->key_file << "\n";
+  }
+  if (settings->record_file) machine->recording = &record_log;
+  unsigned long long end = machine->state.cycles + settings->cycles;
+  if (settings->replay_file) {
+    if (replay_log.load(settings->replay_file)) {
+      machine->replaying = &replay_log;
+      stop = replay(machine, settings, replay_log);
+    } else out << "unable to load input log " << settings->replay_file << "\n";
+  } else if (settings->load_file || !(stop = run_for(machine, settings, BOOT_CYCLES))) { // let the monitor start up
+    type_keys(machine, keys, [&](unsigned long long cycles) { return !(stop = run_for(machine, settings, cycles)); });
+  }
+  if (!stop && machine->state.cycles < end) stop = run_for(machine, settings, end - machine->state.cycles);
+  if (settings->save_file && !machine->save_state(settings->save_file)) {
+    out << "unable to save state to " << settings->save_file << "\n";
+  }
+  if (settings->record_file && !record_log.save(settings->record_file)) {
+    out << "unable to save input log to " << settings->record_file << "\n";
+  }
+  FILE *fp = open_memstream(&status, &size);
+  WriteStatus8080(fp, &machine->state);
+  fclose(fp);
+  out << "== " << (job->tape_file.empty() ? "-" : job->tape_file);
+  out << " " << (job->key_file.empty() ? "-" : job->key_file) << "\n";
+  out << "stopped: " << (stop ? stop : "cycles") << " after " << machine->state.cycles << " cycles\n";
+  out << status << "\n" << vdu_text(machine);
+  free(status);
+  job->result = out.str();
+  if (machine->state.profile) {
+    fp = open_memstream(&status, &size);
+    write_profile(fp, machine->state.profile, settings->symbols);
+    fclose(fp);
+    job->profile = status;
+    free(status);
+  }
+  delete machine;
+}
+
+void worker(WorkQueue *queue, const Settings *settings) {
+  Job *job;
+  while ((job = queue->take()) != NULL) run_job(job, settings);
+}
+
+// Read jobs from a file, one per line: a tape file and optionally a
+// keystroke script, with '-' for no tape
+
+bool read_jobs(const char *job_file, vector<Job> &jobs) {
+  ifstream fs(job_file);
+  string line;
+  if (!fs.is_open()) return false;
+  while (getline(fs, line)) {
+    istringstream words(line);
+    Job job;
+    if (!(words >> job.tape_file) || job.tape_file[0] == '#') continue;
+    if (job.tape_file == "-") job.tape_file.clear();
+    words >> job.key_file;
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  WorkQueue queue;
+  vector<thread> threads;
+  char *key_file = NULL;
+  char *job_file = NULL;
+  char *symbol_files = NULL;
+  char *pend;
+  int nthreads = thread::hardware_concurrency();
+  int i, c;
+
+  opterr = 0;
+  while ((c = getopt(argc, argv, "hc:f:i:j:k:l:m:o:p:qs:u:w:FI:P:T:")) != -1) switch (c) {
+    case 'c': settings.cycles = strtoull(optarg, &pend, 0); break;
+    case 'f': job_file = optarg; break;
+    case 'i': settings.replay_file = optarg; break;
+    case 'j': nthreads = strtoul(optarg, &pend, 0); break;
+    case 'k': key_file = optarg; break;
+    case 'l': settings.load_file = optarg; break;
+    case 'm': if (!parse_mem_top(optarg, settings.mem_top)) exit(1); break;
+    case 'o': settings.printer_file = optarg; break;
+    case 'p': settings.stop_pc = strtoul(optarg, &pend, 0) & 0xffff; break;
+    case 'q': settings.fast_print = true; break;
+    case 's': symbol_files = optarg; break;
+    case 'u': settings.user_rom = optarg; break;
+    case 'w': settings.save_file = optarg; break;
+    case 'F': settings.fast_tape = true; break;
+    case 'I': settings.record_file = optarg; break;
+    case 'P': settings.profile_file = optarg; break;
+    case 'T': settings.tape_program = strtoul(optarg, &pend, 0); break;
+    case 'h': case '?':
+      printf("Headless Triton emulator\n");
+      printf("usage: %s [-h|-?] [-c cycles] [-f job_file] [-i input_log] [-j threads] [-k key_file] [-l state_file] [-m mem_top] [-o printer_file] [-p pc] [-q] [-s symbol_file(s)] [-u user_rom(s)] [-w state_file] [-F] [-I input_log] [-P profile_file] [-T program] [tape_file(s)]\n", argv[0]);
+      printf("-h or -? (help) : print this help\n");
+      printf("-c sets the number of cycles to run each job for, defaults to 8000000 (10 seconds)\n");
+      printf("-f reads jobs from a file, one per line: tape_file (or -) and an optional key_file\n");
+      printf("-i replays an input log recorded with -I, instead of booting and typing keys\n");
+      printf("-j sets the number of threads, defaults to the number of cores\n");
+      printf("-k types the keystrokes in key_file for each tape_file on the command line\n");
+      printf("-l starts each job from a saved state instead of booting the ROMs\n");
+      printf("-m sets the top of memory, a multiple of 0x100 from 0x1400 to 0xff00, for example -m 0x4000, defaults to 0x2000\n");
+      printf("-o sends the printer output of the job (there must be only one) to printer_file, or to a command with |command\n");
+      printf("-p stops a job when the program counter reaches pc\n");
+      printf("-q prints each character in one go, instead of bit banging it through the monitor\n");
+      printf("-s reads symbols for the profile from variable lists printed by trimcc -v, separated by commas\n");
+      printf("-u installs user ROM(s); to install two ROMS separate the filenames by a comma\n");
+      printf("-w saves the state at the end of the job (there must be only one)\n");
+      printf("-F loads programs from tape in one go, instead of a byte at a time through the monitor\n");
+      printf("-I records the input to the job (there must be only one) to input_log\n");
+      printf("-P profiles each job, writing the reports to profile_file\n");
+      printf("-T winds each tape to the start of a program, numbered from 1\n");
+    default:
+      exit(0);
+    }
+
+  if (symbol_files != NULL && !load_symbols(symbol_files, settings.symbols)) exit(1);
+
+  if (job_file != NULL && !read_jobs(job_file, queue.jobs)) {
+    fprintf(stderr, "Unable to open job file %s\n", job_file);
+    exit(1);
+  }
+
+  for (i=optind; i<argc; i++) { // one job per tape file
+    Job job;
+    job.tape_file = argv[i];
+    if (key_file != NULL) job.key_file = key_file;
+    queue.jobs.push_back(job);
+  }
+
+  if (queue.jobs.empty()) { // just boot the ROMs
+    Job job;
+    if (key_file != NULL) job.key_file = key_file;
+    queue.jobs.push_back(job);
+  }
+
+  if ((settings.save_file != NULL || settings.record_file != NULL || settings.printer_file != NULL) && queue.jobs.size() > 1) {
+    fprintf(stderr, "Only one job can save its state, record its input or print to a file\n");
+    exit(1);
+  }
+
+  if (nthreads < 1) nthreads = 1;
+  if (nthreads > (int)queue.jobs.size()) nthreads = queue.jobs.size();
+  for (i=0; i<nthreads; i++) threads.push_back(thread(worker, &queue, &settings));
+  for (i=0; i<nthreads; i++) threads[i].join();
+
+  for (i=0; i<(int)queue.jobs.size(); i++) printf("%s", queue.jobs[i].result.c_str());
+
+  if (settings.profile_file != NULL) {
+    FILE *fp = fopen(settings.profile_file, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "Unable to open profile file %s\n", settings.profile_file);
+      exit(1);
+    }
+    for (i=0; i<(int)queue.jobs.size(); i++) {
+      Job *job = &queue.jobs[i];
+      fprintf(fp, "== %s %s\n", job->tape_file.empty() ? "-" : job->tape_file.c_str(),
+	      job->key_file.empty() ? "-" : job->key_file.c_str());
+      fprintf(fp, "%s\n", job->profile.c_str());
+    }
+    fclose(fp);
+  }
+  return 0;
+}
@@ -0,0 +1,285 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Tapes as audio, see kcs.hpp
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "kcs.hpp"
+
+using namespace std;
+
+#define KCS_SPACE 1200 // Hz, for a 0
+#define KCS_MARK 2400  // Hz, for a 1
+#define KCS_LEADER KCS_BAUD // bits of mark tone before the first byte (a second)
+#define KCS_TRAILER (KCS_BAUD / 10) // and after the last
+#define KCS_AMPLITUDE 16000
+#define KCS_QUIET 256 // the least threshold for a change of sign
+#define WAV_BLOCK 65536 // frames read at a time
+
+// The UART frame: start bit, 8 data bits, even parity, 2 stop bits
+
+static int parity(unsigned int byte) {
+  int n = 0;
+  for (; byte; byte >>= 1) n += byte & 1;
+  return n & 1;
+}
+
+static int frame_bit(uint8_t byte, int bit) {
+  if (bit == 0) return 0;
+  if (bit <= 8) return (byte >> (bit - 1)) & 1;
+  if (bit == 9) return parity(byte);
+  return 1;
+}
+
+KcsDecoder::KcsDecoder(int rate) {
+  bit_time = (double)rate / KCS_BAUD;
+  short_half = (double)rate / (KCS_SPACE + KCS_MARK); // half way between the two
+  min_half = 0.5 * rate / (2 * KCS_MARK);
+  max_half = 2.0 * rate / (2 * KCS_SPACE);
+}
+
+// Decode a block of samples, adding any bytes completed to the end of
+// bytes.  Noise near zero is kept out by hysteresis: the signal has to
+// go past a threshold, set from the loudest sample in the block, to
+// count as having changed sign.  Which side of the thresholds each
+// sample is on is found first, with loops that have no branches so the
+// compiler can vectorise them, leaving the much rarer crossings to be
+// timed one by one.
+
+void KcsDecoder::decode(const int16_t *samples, size_t count, vector<uint8_t> &bytes) {
+  int peak = 0, threshold;
+  size_t i;
+  if (count == 0) return;
+  for (i=0; i<count; i++) peak = max(peak, abs((int)samples[i]));
+  threshold = max(peak / 5, KCS_QUIET);
+  sides.resize(count);
+  for (i=0; i<count; i++) sides[i] = (samples[i] > threshold) | (samples[i] < -threshold) << 1;
+  for (i=0; i<count; i++) {
+    if (sides[i] == 0 || sides[i] == side) continue;
+    int before = i ? samples[i-1] : last_sample;
+    int level = sides[i] == 1 ? threshold : -threshold;
+    double crossing = (double)position + i - 1 + (double)(level - before) / (samples[i] - before);
+    double half = crossing - last_crossing;
+    side = sides[i];
+    if (!crossed) { // the audio may start part way through a half cycle
+      crossed = true;
+      last_crossing = crossing;
+      continue;
+    }
+    if (half < min_half) continue; // a glitch, so take the half cycle as longer
+    if (half > max_half) in_frame = false; // a gap in the tone
+    else half_cycle(last_crossing, crossing, half <= short_half ? 1 : 0, bytes);
+    last_crossing = crossing;
+  }
+  position += count;
+  last_sample = samples[count-1];
+}
+
+// A half cycle of one tone or the other, from start to end.  A space
+// while the line is idle is the leading edge of a start bit, and each
+// bit is then sampled half way through.  The byte is complete at the
+// first stop bit, so that the receiver is ready for the next start bit
+// straight after.
+
+void KcsDecoder::half_cycle(double start, double end, int tone, vector<uint8_t> &bytes) {
+  if (!in_frame) {
+    if (tone == 1) return;
+    in_frame = true;
+    bit = 0;
+    frame = 0;
+    next_sample = start + 0.5 * bit_time;
+  }
+  while (in_frame && next_sample <= end) {
+    if (bit == 0 && tone != 0) in_frame = false; // not a start bit after all
+    else if (bit >= 1 && bit <= 8) frame |= tone << (bit - 1);
+    else if (bit == 9 && tone != parity(frame)) errors++;
+    else if (bit == 10) {
+      if (tone != 1) errors++;
+      bytes.push_back(frame);
+      in_frame = false;
+    }
+    bit++;
+    next_sample += bit_time;
+  }
+}
+
+// The audio for a tape: a second of mark tone, then each byte, then a
+// little more mark tone.  Every bit lasts exactly a whole number of
+// cycles of either tone, so each one starts at a rising zero crossing.
+
+void kcs_encode(const vector<uint8_t> &bytes, int rate, vector<int16_t> &samples) {
+  size_t bits = KCS_LEADER + 11 * bytes.size() + KCS_TRAILER;
+  size_t b, i, start, end;
+  samples.clear();
+  samples.reserve(bits * rate / KCS_BAUD + 1);
+  for (b=0; b<bits; b++) {
+    int value = 1;
+    if (b >= KCS_LEADER && b < KCS_LEADER + 11 * bytes.size()) {
+      value = frame_bit(bytes[(b - KCS_LEADER) / 11], (b - KCS_LEADER) % 11);
+    }
+    double step = 2.0 * M_PI * (value ? KCS_MARK : KCS_SPACE) / rate;
+    start = b * rate / KCS_BAUD;
+    end = (b + 1) * rate / KCS_BAUD;
+    for (i=start; i<end; i++) {
+      double t = i - (double)b * rate / KCS_BAUD;
+      samples.push_back((int16_t)lrint(KCS_AMPLITUDE * sin(step * t)));
+    }
+  }
+}
+
+static uint32_t le(const uint8_t *p, int bytes) {
+  uint32_t value = 0;
+  int i;
+  for (i=0; i<bytes; i++) value |= (uint32_t)p[i] << (8 * i);
+  return value;
+}
+
+static void put_le(vector<uint8_t> &data, uint32_t value, int bytes) {
+  int i;
+  for (i=0; i<bytes; i++) data.push_back((value >> (8 * i)) & 0xff);
+}
+
+// The SubFormat of a WAVE_FORMAT_EXTENSIBLE file holding integer PCM
+// (KSDATAFORMAT_SUBTYPE_PCM)
+
+static const uint8_t pcm_subtype[16] = {
+  0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+};
+
+// Read a tape from a PCM WAV file (8 or 16 bits, the first channel if
+// there are several), decoding it a block at a time.  The format and
+// data chunks may come in either order.  The number of bytes with a
+// bad parity or stop bit is returned in errors.  Audio in which no
+// bytes at all can be found is an error.
+
+bool read_wav(const char *file, vector<uint8_t> &bytes, unsigned long *errors) {
+  ifstream fs(file, ios::in | ios::binary);
+  uint8_t head[12], chunk[8], format[40];
+  bool have_format = false, have_data = false;
+  int channels = 0, rate = 0, width = 0, tag;
+  uint32_t size, data_size = 0;
+  streampos data_at;
+  if (!fs.is_open()) return false;
+  if (!fs.read((char *)head, 12) || memcmp(head, "RIFF", 4) || memcmp(head + 8, "WAVE", 4)) {
+    fprintf(stderr, "%s is not a WAV file\n", file);
+    return false;
+  }
+  while (!(have_format && have_data) && fs.read((char *)chunk, 8)) {
+    size = le(chunk + 4, 4);
+    if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+      uint32_t n = size < sizeof(format) ? size : sizeof(format);
+      if (!fs.read((char *)format, n)) break;
+      fs.seekg(size - n + (size & 1), ios::cur);
+      tag = le(format, 2);
+      channels = le(format + 2, 2);
+      rate = le(format + 4, 4);
+      width = le(format + 14, 2) / 8;
+      have_format = (tag == 1 || (tag == 0xfffe && n >= 40 && !memcmp(format + 24, pcm_subtype, 16)))
+	&& channels > 0 && rate > 0 && (width == 1 || width == 2);
+      if (!have_format) break;
+    } else if (!memcmp(chunk, "data", 4) && !have_data) {
+      have_data = true;
+      data_at = fs.tellg();
+      data_size = size;
+      if (!have_format) fs.seekg(size + (size & 1), ios::cur); // the format comes after
+    } else fs.seekg(size + (size & 1), ios::cur);
+  }
+  if (!have_format || !have_data) {
+    fprintf(stderr, "%s is not a PCM WAV file of 8 or 16 bit integer samples with both a format and a data chunk\n", file);
+    return false;
+  }
+  fs.clear();
+  fs.seekg(data_at);
+  KcsDecoder decoder(rate);
+  vector<uint8_t> raw(WAV_BLOCK * channels * width);
+  vector<int16_t> samples(WAV_BLOCK);
+  size_t frames = data_size / (channels * width), n, i;
+  bool empty = (frames == 0);
+  bytes.clear();
+  while (frames > 0) {
+    n = frames < WAV_BLOCK ? frames : WAV_BLOCK;
+    if (!fs.read((char *)raw.data(), n * channels * width)) n = fs.gcount() / (channels * width);
+    if (n == 0) break;
+    if (width == 1) for (i=0; i<n; i++) samples[i] = (int16_t)((raw[i * channels] - 0x80) * 256);
+    else for (i=0; i<n; i++) samples[i] = (int16_t)le(&raw[2 * i * channels], 2);
+    decoder.decode(samples.data(), n, bytes);
+    frames -= n;
+  }
+  if (errors) *errors = decoder.errors;
+  if (bytes.empty() && !empty) {
+    fprintf(stderr, "%s has no tape data that can be decoded\n", file);
+    return false;
+  }
+  return true;
+}
+
+// Write a tape as a 16 bit mono PCM WAV file
+
+bool write_wav(const char *file, const vector<uint8_t> &bytes, int rate) {
+  vector<int16_t> samples;
+  vector<uint8_t> head;
+  kcs_encode(bytes, rate, samples);
+  uint32_t size = 2 * samples.size();
+  head.reserve(44 + size);
+  head.insert(head.end(), {'R', 'I', 'F', 'F'});
+  put_le(head, 36 + size, 4);
+  head.insert(head.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+  put_le(head, 16, 4); // format chunk size
+  put_le(head, 1, 2); // PCM
+  put_le(head, 1, 2); // mono
+  put_le(head, rate, 4);
+  put_le(head, 2 * rate, 4); // bytes per second
+  put_le(head, 2, 2); // bytes per frame
+  put_le(head, 16, 2); // bits per sample
+  head.insert(head.end(), {'d', 'a', 't', 'a'});
+  put_le(head, size, 4);
+  ofstream fs(file, ios::out | ios::binary | ios::trunc);
+  if (!fs.is_open()) return false;
+  for (int16_t sample : samples) put_le(head, (uint16_t)sample, 2);
+  fs.write((char *)head.data(), head.size());
+  return fs.good();
+}
+
+// A tape file ending in .wav (in either case) is audio
+
+bool is_wav(const string &file) {
+  size_t n = file.size();
+  if (n < 4 || file[n-4] != '.') return false;
+  return tolower(file[n-3]) == 'w' && tolower(file[n-2]) == 'a' && tolower(file[n-1]) == 'v';
+}
@@ -0,0 +1,86 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Tapes as audio.  The Triton's UART sends each byte at 300 baud as a
+ * start bit, 8 data bits (least significant first), a parity bit and 2
+ * stop bits, and the cassette interface turns each bit into Kansas City
+ * tones: four cycles of 1200 Hz for a 0, eight cycles of 2400 Hz for a
+ * 1.  These turn the byte stream into WAV files and back again.
+ */
+
+#ifndef _KCS_HPP
+#define _KCS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define KCS_BAUD 300
+#define KCS_RATE_DEFAULT 44100
+#define KCS_RATE_MIN 8000
+
+// Turn audio into bytes a block of samples at a time, from the zero
+// crossings (with some hysteresis).  Each half cycle is a 1 if it is short (2400 Hz) and a 0
+// if it is long (1200 Hz), and the UART framing is recovered from
+// these as it would be by the receiver, sampling in the middle of each
+// bit after the leading edge of a start bit.
+
+class KcsDecoder {
+public:
+  unsigned long errors = 0; // bytes with a bad parity or stop bit
+  KcsDecoder(int rate);
+  void decode(const int16_t *samples, size_t count, std::vector<uint8_t> &bytes);
+private:
+  double bit_time; // in samples
+  double short_half; // the longest half cycle taken as 2400 Hz
+  double min_half, max_half; // half cycles outside these are noise or a gap
+  bool crossed = false; // whether last_crossing has been found yet
+  double last_crossing = 0.0;
+  int16_t last_sample = 0;
+  uint64_t position = 0; // of the next sample
+  bool in_frame = false;
+  double next_sample = 0.0; // when the next bit of the frame is to be sampled
+  int bit = 0; // the next bit of the frame, 0 being the start bit
+  unsigned int frame = 0;
+  int side = 0; // 1 above the threshold, 2 below it
+  std::vector<uint8_t> sides; // the same for each sample in a block
+  void half_cycle(double start, double end, int tone, std::vector<uint8_t> &bytes);
+};
+
+void kcs_encode(const std::vector<uint8_t> &bytes, int rate, std::vector<int16_t> &samples);
+bool read_wav(const char *file, std::vector<uint8_t> &bytes, unsigned long *errors = NULL);
+bool write_wav(const char *file, const std::vector<uint8_t> &bytes, int rate = KCS_RATE_DEFAULT);
+bool is_wav(const std::string &file);
+
+#endif
@@ -0,0 +1,1334 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* The Transam Triton as a self-contained machine, see machine.hpp
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "machine.hpp"
+#include "kcs.hpp"
+#include <chrono>
+
+using namespace std;
+
+// Write a character to VDU memory, marking its row as changed
+
+static inline void vdu_write(Bus8080 *bus, int offset, uint8_t byte) {
+  bus->memory[0x1000 + offset] = byte;
+  bus->dirty[(0x1000 + offset) >> 6] = 1;
+}
+
+// Takes input from port 5 buffer (IC 51) and attempts to duplicate
+// Thomson-CSF VDU controller (IC 61) interface with video RAM
+
+void IOState::vdu_strobe(State8080 *state, Bus8080 *bus) {
+  int i;
+  int input = vdu_buffer & 0x7f;
+  switch(input) {
+  case 0x00: break; // NUL
+  case 0x04: break; // EOT (End of Text)
+  case 0x08: // Backspace
+    if (--cursor_position < 0) cursor_position += 1024;
+    break;
+  case 0x09: // Step cursor RIGHT
+    if (++cursor_position >= 1024) cursor_position -= 1024;
+    break;
+  case 0x0a: // Line feed
+    cursor_position += 64;
+    if (cursor_position >= 1024) {
+      cursor_position -= 64;
+      if (++vdu_startrow > 15) vdu_startrow = 0;
+      for (i=0; i<64; i++) {
+	vdu_write(bus, ((64 * vdu_startrow) + cursor_position + i) % 1024, 0x20);
+      }
+    }
+    break;
+  case 0x0b: // Step cursor UP
+    cursor_position -=64;
+    if (cursor_position < 0) cursor_position += 1024;
+    break;
+  case 0x0c: // Clear screen/reset cursor
+    for (i=0; i<1024; i++) vdu_write(bus, i, 0x20);
+    cursor_position = 0;
+    vdu_startrow = 0;
+    break;
+  case 0x0d: // Carriage return / clear line
+    if (cursor_position % 64 != 0) {
+      while(cursor_position % 64 != 0) {
+	vdu_write(bus, ((64 * vdu_startrow) + cursor_position++) % 1024, 0x20);
+      }
+      cursor_position -= 64;
+    }
+    break;
+  case 0x1b: // Screen roll (changes which memory location represents top of screen)
+    if (++vdu_startrow > 15) vdu_startrow = 0;
+    cursor_position -= 64;
+    if (cursor_position < 0) cursor_position += 1024;
+    break;
+  case 0x1c: // Reset cursor
+    cursor_position = 0;
+    break;
+  case 0x1d: // Carriage return (no clear)
+    cursor_position -= (cursor_position % 64);
+    break;
+  default:
+    vdu_write(bus, ((64 * vdu_startrow) + cursor_position) % 1024, input);
+    if (++cursor_position >= 1024) {
+      cursor_position -= 64;
+      if (++vdu_startrow > 15) vdu_startrow = 0;
+      for (i=0; i<64; i++) {
+	vdu_write(bus, ((64 * vdu_startrow) + cursor_position + i) % 1024, 0x20);
+      }
+    }
+    break;
+  }
+}
+
+// #define PRINTF_HI(byte) for (int i=7; i>=4; i--) printf("%c", (byte >> i) & 1 ? '1' : '0')
+// #define PRINTF_LO(byte) for (int i=3; i>=0; i--) printf("%c", (byte >> i) & 1 ? '1' : '0')
+// #define PRINTF_BIN(byte) printf("%02X (", byte); PRINTF_HI(byte); PRINTF_LO(byte); printf(")")
+
+// void WriteStatusEPROM(FILE *fp, StateEPROM *eprom) {
+//   fprintf(fp, "A/FC="); PRINTF_BIN(eprom->a);
+//   fprintf(fp, " B/FD="); PRINTF_BIN(eprom->b);
+//   fprintf(fp, " C/FE="); PRINTF_BIN(eprom->c);
+//   fprintf(fp, " ctrl="); PRINTF_BIN(eprom->ctl);
+// }
+
+// Ports 0xfc to 0xff belong to the Intel 8255 in the EPROM programmer.
+// The implementation is not a generic 8255 emulation however.
+
+void TritonMachine::in_out() {
+  State8080 *state = &this->state;
+  IOState *io = &this->io;
+  StateEPROM *eprom = &this->eprom;
+  switch(state->port) {
+  case 0: // Keyboard buffer (IC 49)
+    state->a = io->key_buffer;
+    break;
+  case 1: // Get UART status
+    state->a = io->uart_status;
+    break;
+  case 2: // Output data to tape
+    if (io->tape_relay) {
+      if (io->tape_status == ' ') {
+	if (!tape_file.empty()) io->tape_status = 'w'; // collected, see flush_tape
+	// tape_file was NULL - dump bytes
+      }
+      if (io->tape_status == 'w') tape_written.push_back(state->a);
+    }
+    break;
+  case 3: // LED buffer (IC 50)
+    io->led_buffer = state->a;
+    break;
+  case 4: // Input data from tape
+    if (io->tape_relay) {
+      if (io->tape_status == ' ') {
+	if (!tape_file.empty()) { // carry on from where the tape was left
+	  if (tape_loaded || load_tape()) io->tape_status = 'r';
+	  else {
+	    io->tape_relay = false;
+	    fprintf(stderr, "Unable to open tape file %s for reading\n", tape_file.c_str());
+	  }
+	} // Tape file was NULL - return 0xff as below
+      } else if (io->tape_status == 'r' && !tape_loaded && !load_tape()) { // restored part way through
+	io->tape_status = ' ';
+	io->tape_relay = false;
+	fprintf(stderr, "Unable to open tape file %s for reading\n", tape_file.c_str());
+      }
+      if ((io->tape_status == 'r') && (tape_cursor < tape_data.size())) {
+	state->a = tape_data[tape_cursor++];
+	if (fast_tape && !recording && !replaying) fast_load();
+      } else { // return 0xff as bad data, and at the end go back to the start
+	state->a = 0xff;
+	tape_cursor = 0;
+      }
+      // When replaying, the tape moves on as above but the data comes
+      // from the input log
+      if (replaying) state->a = replaying->tape_byte(state->cycles);
+      if (recording) recording->add(state->cycles, 't', state->a);
+    }
+    break;
+  case 5: // VDU buffer (IC 51)
+    if (io->vdu_buffer != state->a) {
+      io->vdu_buffer = state->a;
+      if (state->a >= 0x80) io->vdu_strobe(state, &bus);
+    }
+    break;
+  case 6: // port 6 latches (IC 52) -- printer emulation
+    uint8_t byte;
+    byte = state->a & 0x80; // keep only bit 8 of the output
+    if (io->port6_bit_count == 0) {
+      if (byte == 0x80 && fast_print && !recording && !replaying && print_char()) break;
+      if (byte == 0x80) { // start bit
+	io->print_byte = 0x00; // keep track of bit-banged output
+	io->port6_bit_count = 1;
+      }
+    } else {
+      if (io->port6_bit_count < 9) { // seven data bits, with eighth (fake parity) bit always set
+	io->print_byte = (io->print_byte >> 1) | byte;
+	io->port6_bit_count++;
+      } else { // stop bit - process captured output to ASCII character
+	byte = ~io->print_byte; // complement; fake parity bit is now unset
+	printer.put(byte); // this is now an ASCII character and can be printed
+	io->port6_bit_count = 0; // reset counter and look out for next start bit
+      }
+    }
+    break;
+  case 7: // port 7 latches (IC 52) and tape power switch (RLY 1)
+    if (tone_changes && io->oscillator != ((state->a & 0x40) != 0)) {
+      tone_changes->push_back({state->cycles, !io->oscillator, false});
+    }
+    io->oscillator = ((state->a & 0x40) != 0);
+    if (((state->a & 0x80) != 0) && (io->tape_relay == false)) io->tape_relay = true;
+    if (((state->a & 0x80) == 0) && io->tape_relay) {
+      if (io->tape_status == 'w') flush_tape();
+      io->tape_status = ' ';
+      io->tape_relay = false;
+    }
+    break;
+  case 0xfc: // 8255 port A (IN or OUT selected by control word - see below)
+    if (state->port_op == 0xd3 && eprom->portA_dirn == OUTPUT) eprom->a = state->a; // output
+    else { // input if port A direction is IN and EPROM CS is enabled
+      if (eprom->portA_dirn == INPUT && eprom->chip_select) {
+	uint8_t upper = eprom->c & 0x03; // the least two bits of C are the top two bits of the address
+	uint16_t address = ((upper << 8) | (eprom->b)) & 0x03ff; // form the full address from these and B
+	eprom->a = eprom->rom[address]; // read from ROM
+      } else eprom->a = 0xff; // failed to meet test to read from ROM, return 0xff
+      state->a = eprom->a;
+    }
+    break;
+  case 0xfd: // 8255 port B (always OUT)
+    if (state->port_op == 0xd3) eprom->b = state->a;
+    break;
+  case 0xfe: // 8255 port C (lower 4 bits always OUT; upper 4 bits always IN)
+    if (state->port_op == 0xd3) { // output
+      eprom->c = (eprom->c & 0xf0) | (state->a & 0x0f); // latch only lower 4 bits
+      eprom->chip_select = ((eprom->c & 0x0c) == 0x04); // implement the hardware logic that..
+      eprom->write_enable = ((eprom->c & 0x0c) == 0x08); // connects C bits 2, 3 to 2708 CS/WE
+      // write to EPROM if port A direction is OUT and the EPROM is write-enabled
+      if (eprom->portA_dirn == OUTPUT && eprom->write_enable) {
+	uint8_t upper = eprom->c & 0x03; // the least two bits of C are the top two bits of the address
+	uint16_t address = ((upper << 8) | (eprom->b)) & 0x03ff; // form the full address from these and B
+	if (!eprom->failed) eprom->rom[address] &= eprom->a; // can only _unset_ bits, 1 --> 0, hence '&='
+	eprom->write_count[address]++; // increment the write count for that memory location
+	eprom->c &= 0xef; // clear the high bit in C to show successful write sequence
+      }
+    } else { // input
+      state->a = (eprom->c & 0xf0) & 0x0f; // just read the upper 4 bits
+    }
+    break;
+  case 0xff: // 8255 control word; bit 4 (& 0x10) sets the direction of port A
+    if (state->port_op == 0xd3) {
+      eprom->ctl = state->a;
+      eprom->portA_dirn = (eprom->ctl & 0x10) == 0x00 ? OUTPUT : INPUT;
+    }
+    break;
+  }
+  //  if (state->port > 0xfb) {
+  //    printf("8255: %02X ", state->a);
+  //    if (state->port_op == 0xd3) printf("-->");
+  //    else printf("<--");
+  //    switch (state->port) {
+  //    case 0xfc: printf(" port A/FC"); break;
+  //    case 0xfd: printf(" port B/FD"); break;
+  //    case 0xfe: printf(" port C/FE"); break;
+  //    case 0xff: printf(" ctrl  /FF"); break;
+  //    }
+  //    printf(" | "); WriteStatusEPROM(stdout, eprom);
+  //    printf(" | "); WriteStatus8080(stdout, state); printf("\n");
+  //  }
+  state->port_op = 0x00;
+}
+
+// RAM is mapped in whole pages, so the top of memory has to be on a
+// page boundary, and it can be no lower than the end of the VDU memory
+
+bool valid_mem_top(unsigned long top) {
+  return (top & 0xff) == 0 && top >= MEM_TOP_MIN && top <= MEM_TOP_MAX;
+}
+
+// Read the top of memory from a command line option, checking it
+// before it is narrowed to 16 bits
+
+bool parse_mem_top(const char *arg, uint16_t &top) {
+  char *end;
+  unsigned long value = strtoul(arg, &end, 0);
+  if (end == arg || *end != '\0' || !valid_mem_top(value)) {
+    fprintf(stderr, "The top of memory (-m) must be a multiple of 0x100 from 0x%04X to 0x%04X\n",
+	    MEM_TOP_MIN, MEM_TOP_MAX);
+    return false;
+  }
+  top = value;
+  return true;
+}
+
+void load_rom(uint8_t *memory, const char *rom_name, uint16_t rom_start, uint16_t rom_size) {
+  ifstream rom;
+  rom.open(rom_name, ios::in | ios::binary);
+  if (rom.is_open()) {
+    rom.read((char *) &memory[rom_start], rom_size);
+    rom.close();
+    fprintf(stderr, "%04X-%04X: %s loaded\n", rom_start, rom_start+rom_size-1, rom_name);
+  }
+}
+
+// Set all bytes to 0xff and (re)initialise write counts.
+
+void UV_erase(StateEPROM *eprom) {
+  int i;
+  for (i=0; i<_1K; i++) {
+      eprom->rom[i] = 0xff;
+      eprom->write_count[i] = 0;
+  }
+}
+
+// Check to see if any write counts were less than 100.
+
+bool check_write_counts(StateEPROM *eprom) {
+  int i;
+  for (i=0; i<_1K; i++) {
+    if (eprom->write_count[i] < 100) return true;
+  }
+  return false;
+}
+
+// Set up a machine with empty memory and user RAM up to mem_top
+
+TritonMachine::TritonMachine(uint16_t mem_top) : io(), mem_top(mem_top) {
+  int i;
+  for (i=0; i<_64K; i++) memory[i] = 0xff;
+
+  // Map the pages: the ROMs and unused space read only, VDU memory
+  // write only, and user RAM from the end of the VDU to mem_top
+
+  InitBus8080(&bus, memory);
+  MapPages8080(&bus, 0x1000, 0x1400, PAGE_VDU);
+  MapPages8080(&bus, 0x1400, mem_top, PAGE_RAM);
+
+  io.vdu_startrow = 0;
+
+  io.uart_status = 0x11;
+  io.tape_status = ' ';
+
+  io.print_byte = 0x00;
+  io.port6_bit_count = 0;
+
+  UV_erase(&eprom);
+
+  Reset8080(&state);
+  EnableCache8080(&state, true);
+}
+
+TritonMachine::~TritonMachine() {
+  EnableCache8080(&state, false);
+  if (!tape_written.empty()) flush_tape();
+}
+
+// Load the L7.2 ROMs, and the user ROM(s) if user_roms is not NULL;
+// to install two ROMS separate the filenames by a comma
+
+void TritonMachine::load_roms(const char *user_roms) {
+  load_rom(memory, "mona72.bin",  0x0000, _1K);
+  load_rom(memory, "monb72.bin",  0x0c00, _1K);
+  load_rom(memory, "trap.bin",    0xc000, _8K);
+  load_rom(memory, "basic72.bin", 0xe000, _8K);
+
+  if (user_roms != NULL) {
+    string first = user_roms;
+    size_t comma = first.find(','); // check for a comma
+    if (comma != string::npos) {
+      load_rom(memory, first.substr(comma + 1).c_str(), 0x0800, _1K); // use the remainder to load the second user ROM
+      first.resize(comma); // truncate at the comma
+    }
+    load_rom(memory, first.c_str(), 0x0400, _1K); // load the first user ROM
+  }
+
+  if (eprom.file != NULL) load_rom(eprom.rom, eprom.file, 0x0000, _1K);
+
+  FlushCache8080(&state);
+}
+
+// Hardware reset
+
+void TritonMachine::reset() {
+  if (recording) recording->add(state.cycles, 'r', 0);
+  Reset8080(&state);
+}
+
+// Jam an RST instruction, taken when interrupts are enabled
+
+void TritonMachine::interrupt(uint8_t rst) {
+  if (recording) recording->add(state.cycles, 'i', rst);
+  state.interrupt = rst;
+}
+
+// The rows of VDU memory written to since the last call, as a bit
+// for each row
+
+uint16_t TritonMachine::vdu_changes() {
+  uint16_t rows = 0;
+  int row;
+  for (row=0; row<16; row++) {
+    if (bus.dirty[(0x1000 >> 6) + row]) {
+      bus.dirty[(0x1000 >> 6) + row] = 0;
+      rows |= 1 << row;
+    }
+  }
+  return rows;
+}
+
+// A key has been pressed or released, where byte is the code for the
+// key, placing data in port 0 (IC 49)
+
+void TritonMachine::key_press(uint8_t byte, bool pressed) {
+  if (recording) recording->add(state.cycles, pressed ? 'k' : 'u', byte);
+  io.key_buffer = byte; // set the key buffer
+  if (pressed) io.key_buffer |= 0x80; // set the strobe bit
+}
+
+// Whether the processor is in the same state at two points, as far
+// as what it will go on to do is concerned
+
+static bool same_registers(State8080 a, State8080 b) {
+  SyncFlags8080(&a);
+  SyncFlags8080(&b);
+  return a.a == b.a && a.b == b.b && a.c == b.c && a.d == b.d && a.e == b.e && a.h == b.h && a.l == b.l
+    && a.sp == b.sp && a.pc == b.pc && a.cc.z == b.cc.z && a.cc.s == b.cc.s && a.cc.p == b.cc.p
+    && a.cc.cy == b.cc.cy && a.cc.ac == b.cc.ac && a.int_enable == b.int_enable && a.interrupt == b.interrupt;
+}
+
+// Called at the first read of the keyboard in a run.  If the
+// processor, the VDU memory and RAM, and the key are just as they were
+// at the first read of the keyboard in the last run, with no other
+// I/O in between, the machine is going round a loop which only a key
+// (or an interrupt or reset) can get it out of.  The state is then
+// kept for next time.
+
+bool TritonMachine::keyboard_poll() {
+  uint8_t *start = &memory[0x1000];
+  uint8_t *end = &memory[mem_top > 0x1400 ? mem_top : 0x1400];
+  bool same = poll_valid && !poll_other_io && poll_key == io.key_buffer && same_registers(poll_state, state)
+    && poll_memory.size() == (size_t)(end - start) && equal(start, end, poll_memory.begin());
+  if (!same) poll_memory.assign(start, end);
+  poll_valid = true;
+  poll_state = state;
+  poll_key = io.key_buffer;
+  poll_other_io = false;
+  return same;
+}
+
+// Send a number of clock pulses to the CPU, handling IN and OUT as
+// they happen.  Returns false if the processor has halted.  If
+// detect_polling is set, polling is set when the run found the
+// machine waiting in a loop for a key (see above), so that it need
+// not be run again until there is a key, an interrupt or a reset.
+
+bool TritonMachine::run(int cycles) {
+  unsigned long long end = state.cycles + cycles;
+  bool first_poll = true;
+  polling = false;
+  while (state.cycles < end) {
+    Stop8080 stop = Run8080(&state, &bus, end - state.cycles);
+    if (stop == STOP_HALT) return false;
+    if (stop == STOP_PORT) {
+      if (detect_polling) {
+	if (state.port_op == 0xdb && state.port == 0) {
+	  if (first_poll) polling = keyboard_poll();
+	  first_poll = false;
+	} else {
+	  poll_other_io = true;
+	  polling = false;
+	}
+      }
+      in_out();
+    }
+  }
+  return true;
+}
+
+// The monitor's tape load (the I command) reads a program a byte at a
+// time through the routine at 0x0e62, called from 0x0365, called from
+// the loop at 0x0357 that stores the bytes from HL up to DE.  When the
+// byte just read is on its way back to that loop, the rest of the
+// program is copied from the tape in one go, and the processor carries
+// on from the jump at 0x0362 with the registers and flags as the loop
+// leaves them, but without the cycles it would have taken.  Anything
+// else, including a program running off the end of the tape, is left
+// to the monitor.
+
+#define FAST_LOAD_LOOP 0x0357
+#define FAST_LOAD_DONE 0x0362
+#define FAST_LOAD_BYTE 0x0368 // return address into 0x0365
+#define FAST_LOAD_STORE 0x035a // return address into the loop
+#define FAST_LOAD_COMPARE 0x035f // return address from the last comparison
+
+static const uint8_t fast_load_loop[] = {
+  0xcd, 0x65, 0x03, // CALL 0365
+  0x77,             // MOV M,A
+  0x23,             // INX H
+  0xcd, 0xbf, 0x00, // CALL 00BF (compare HL with DE)
+  0xc2, 0x57, 0x03  // JNZ 0357
+};
+
+void TritonMachine::fast_load() {
+  uint16_t sp = state.sp;
+  uint16_t address = (state.h << 8) | state.l;
+  uint16_t end = (state.d << 8) | state.e;
+  size_t count = (uint16_t)(end - address);
+  uint8_t byte = state.a;
+  size_t i;
+  if (state.pc != 0x0e6b) return; // at the RET after IN 04
+  if ((memory[sp] | memory[(uint16_t)(sp + 1)] << 8) != FAST_LOAD_BYTE) return;
+  if ((memory[(uint16_t)(sp + 2)] | memory[(uint16_t)(sp + 3)] << 8) != FAST_LOAD_STORE) return;
+  if (memcmp(memory + FAST_LOAD_LOOP, fast_load_loop, sizeof(fast_load_loop)) != 0) return;
+  if (count == 0 || tape_cursor + count - 1 > tape_data.size()) return;
+  for (i=0; i<count; i++) {
+    if (i > 0) byte = tape_data[tape_cursor++];
+    WriteMemory8080(&state, &bus, address++, byte);
+  }
+  SyncFlags8080(&state);
+  state.a = state.e; // from comparing HL with DE, which are now equal
+  state.b = byte;
+  state.h = state.d;
+  state.l = state.e;
+  state.cc.z = true;
+  state.cc.s = false;
+  state.cc.p = true;
+  state.cc.cy = false;
+  state.cc.ac = true;
+  WriteMemory8080(&state, &bus, sp + 2, FAST_LOAD_COMPARE & 0xff); // left below the stack
+  WriteMemory8080(&state, &bus, sp + 3, FAST_LOAD_COMPARE >> 8);
+  state.sp += 4;
+  state.pc = FAST_LOAD_DONE;
+}
+
+// The monitor prints a character (when printing is switched on) by
+// bit banging it out of port 6 from 0x010c onwards, with a delay after
+// each bit.  At the start bit, the character is printed straight away,
+// and the processor carries on from 0x0137, where the routine goes on
+// to the VDU, as it would at the end: with interrupts enabled again
+// and BC popped, leaving the character pushed for the VDU output.
+
+#define PRINT_START_BIT 0x0118 // after the first OUT 06
+#define PRINT_DONE 0x0137
+
+static const uint8_t print_routine[] = {
+  0xf1, // POP PSW
+  0xf5, // PUSH PSW
+  0xf3, // DI
+  0xc5  // PUSH B
+};
+
+bool TritonMachine::print_char() {
+  uint16_t sp = state.sp;
+  if (state.pc != PRINT_START_BIT) return false;
+  if (memcmp(memory + 0x010c, print_routine, sizeof(print_routine)) != 0) return false;
+  printer.put(memory[(uint16_t)(sp + 3)]); // A, under the flags and BC
+  state.c = memory[sp];
+  state.b = memory[(uint16_t)(sp + 1)];
+  state.sp += 2;
+  state.int_enable = true;
+  state.pc = PRINT_DONE;
+  return true;
+}
+
+// The whole machine can be saved and restored, in a compact binary
+// form: "TRST", the version and the top of memory, then the latches
+// (processor, I/O, EPROM programmer and tape), then the 64K of memory.
+// Everything is little endian.
+
+#define STATE_MAGIC "TRST"
+#define STATE_VERSION 1
+
+typedef struct StateReader {
+  const uint8_t *p;
+  const uint8_t *end;
+  bool ok;
+} StateReader;
+
+static void put(vector<uint8_t> &data, uint64_t value, int bytes) {
+  int i;
+  for (i=0; i<bytes; i++) data.push_back((value >> (8 * i)) & 0xff);
+}
+
+static uint64_t get(StateReader &in, int bytes) {
+  uint64_t value = 0;
+  int i;
+  if (in.end - in.p < bytes) {
+    in.ok = false;
+    return 0;
+  }
+  for (i=0; i<bytes; i++) value |= (uint64_t)*in.p++ << (8 * i);
+  return value;
+}
+
+// Everything but the memory
+
+static void save_latches(TritonMachine *machine, vector<uint8_t> &data) {
+  State8080 &state = machine->state;
+  IOState &io = machine->io;
+  StateEPROM &eprom = machine->eprom;
+  int i;
+  SyncFlags8080(&state);
+  put(data, state.a, 1); put(data, state.b, 1); put(data, state.c, 1);
+  put(data, state.d, 1); put(data, state.e, 1); put(data, state.h, 1); put(data, state.l, 1);
+  put(data, state.sp, 2); put(data, state.pc, 2);
+  put(data, state.cc.z | state.cc.s << 1 | state.cc.p << 2 | state.cc.cy << 3 | state.cc.ac << 4, 1);
+  put(data, state.port, 1); put(data, state.port_op, 1);
+  put(data, state.int_enable, 1); put(data, state.interrupt, 1); put(data, state.halted, 1);
+  put(data, state.cycles, 8); put(data, state.instructions, 8);
+  put(data, io.key_buffer, 4); put(data, io.led_buffer, 1); put(data, io.vdu_buffer, 4);
+  put(data, io.port6_bit_count, 4); put(data, io.print_byte, 1);
+  put(data, io.oscillator, 1); put(data, io.tape_relay, 1);
+  put(data, io.cursor_position, 4); put(data, io.tape_status, 4);
+  put(data, io.uart_status, 4); put(data, io.vdu_startrow, 4);
+  put(data, eprom.a, 1); put(data, eprom.b, 1); put(data, eprom.c, 1); put(data, eprom.ctl, 1);
+  data.insert(data.end(), eprom.rom, eprom.rom + _1K);
+  for (i=0; i<_1K; i++) put(data, eprom.write_count[i], 4);
+  put(data, eprom.chip_select, 1); put(data, eprom.write_enable, 1);
+  put(data, eprom.failed, 1); put(data, eprom.portA_dirn, 1);
+  put(data, machine->tape_file.size(), 2);
+  data.insert(data.end(), machine->tape_file.begin(), machine->tape_file.end());
+  put(data, machine->tape_position(), 8);
+}
+
+// The latches are read into copies, which are only put in place once
+// everything has been read
+
+typedef struct Latches {
+  State8080 state;
+  IOState io;
+  StateEPROM eprom;
+  string tape_file;
+  uint64_t position;
+} Latches;
+
+static bool read_latches(TritonMachine *machine, StateReader &in, Latches &latches) {
+  State8080 &state = latches.state;
+  IOState &io = latches.io;
+  StateEPROM &eprom = latches.eprom;
+  uint8_t cc, dirn;
+  int i;
+  state = machine->state;
+  io = machine->io;
+  eprom = machine->eprom;
+  state.a = get(in, 1); state.b = get(in, 1); state.c = get(in, 1);
+  state.d = get(in, 1); state.e = get(in, 1); state.h = get(in, 1); state.l = get(in, 1);
+  state.sp = get(in, 2); state.pc = get(in, 2);
+  cc = get(in, 1);
+  state.cc.z = cc & 0x01; state.cc.s = cc & 0x02; state.cc.p = cc & 0x04;
+  state.cc.cy = cc & 0x08; state.cc.ac = cc & 0x10;
+  state.pending = 0;
+  state.port = get(in, 1); state.port_op = get(in, 1);
+  state.int_enable = get(in, 1); state.interrupt = get(in, 1); state.halted = get(in, 1);
+  state.cycles = get(in, 8); state.instructions = get(in, 8);
+  io.key_buffer = (int32_t)get(in, 4); io.led_buffer = get(in, 1); io.vdu_buffer = (int32_t)get(in, 4);
+  io.port6_bit_count = get(in, 4); io.print_byte = get(in, 1);
+  io.oscillator = get(in, 1); io.tape_relay = get(in, 1);
+  io.cursor_position = (int32_t)get(in, 4); io.tape_status = (int32_t)get(in, 4);
+  io.uart_status = (int32_t)get(in, 4); io.vdu_startrow = (int32_t)get(in, 4);
+  eprom.a = get(in, 1); eprom.b = get(in, 1); eprom.c = get(in, 1); eprom.ctl = get(in, 1);
+  for (i=0; i<_1K; i++) eprom.rom[i] = get(in, 1);
+  for (i=0; i<_1K; i++) eprom.write_count[i] = (int32_t)get(in, 4);
+  eprom.chip_select = get(in, 1); eprom.write_enable = get(in, 1);
+  eprom.failed = get(in, 1); dirn = get(in, 1);
+  eprom.portA_dirn = (dirn == OUTPUT) ? OUTPUT : INPUT;
+  latches.tape_file.clear();
+  for (i=get(in, 2); i>0 && in.ok; i--) latches.tape_file += (char)get(in, 1);
+  latches.position = get(in, 8);
+  return in.ok && (dirn == INPUT || dirn == OUTPUT)
+    && io.cursor_position >= 0 && io.cursor_position < 1024
+    && io.vdu_startrow >= 0 && io.vdu_startrow <= 15;
+}
+
+// Put the latches in place and open the tape again where it was
+
+static void restore_latches(TritonMachine *machine, const Latches &latches) {
+  char *eprom_file = machine->eprom.file; // where F4 writes to is not part of the state
+  machine->state = latches.state;
+  machine->io = latches.io;
+  machine->eprom = latches.eprom;
+  machine->eprom.file = eprom_file;
+  machine->tape_file = latches.tape_file;
+  machine->restore_tape(latches.position);
+}
+
+// Read the whole of the tape file into memory, the first time it is
+// read from (or after a state is restored).  The tape then
+// runs as a loop: it is not rewound when the relay goes off, and
+// carries on from the start after reaching the end.
+
+bool TritonMachine::load_tape() {
+  unsigned long errors = 0;
+  tape_writer.wait(); // for anything still on its way to the file
+  if (is_wav(tape_file)) {
+    if (!read_wav(tape_file.c_str(), tape_data, &errors)) return false;
+    if (errors) fprintf(stderr, "Tape interface: %lu bad bytes in %s\n", errors, tape_file.c_str());
+  } else {
+    ifstream fs(tape_file, ios::in | ios::binary);
+    if (!fs.is_open()) return false;
+    tape_data.assign(istreambuf_iterator<char>(fs), istreambuf_iterator<char>());
+  }
+  tape_index = index_tape(tape_data);
+  tape_loaded = true;
+  return true;
+}
+
+// Hand the bytes written since the relay went on to the writer, and
+// add them to the tape in memory too, if it has been read in, so it
+// need not be read again
+
+void TritonMachine::flush_tape() {
+  if (tape_loaded) {
+    tape_data.insert(tape_data.end(), tape_written.begin(), tape_written.end());
+    tape_index = index_tape(tape_data);
+  }
+  tape_writer.append(tape_file, tape_written);
+  tape_written.clear();
+}
+
+// Queue bytes to be added to the end of a tape file (taking them from
+// bytes), starting the thread the first time
+
+void TapeWriter::append(const string &file, vector<uint8_t> &bytes) {
+  lock_guard<mutex> guard(lock);
+  queue.push_back({file, std::move(bytes)});
+  if (!thread.joinable()) thread = std::thread(&TapeWriter::run, this);
+  changed.notify_all();
+}
+
+// Wait until everything queued is in the tape files
+
+void TapeWriter::wait() {
+  unique_lock<mutex> guard(lock);
+  changed.wait(guard, [this] { return queue.empty() && !busy; });
+}
+
+TapeWriter::~TapeWriter() {
+  {
+    lock_guard<mutex> guard(lock);
+    stop = true;
+    changed.notify_all();
+  }
+  if (thread.joinable()) thread.join();
+}
+
+#define PRINTER_BUFFER 4096 // characters before they are written out straight away
+#define PRINTER_FLUSH_MS 100 // and how long they wait otherwise
+
+// Send the printer output to a file, or a pipe if target starts with |
+
+bool Printer::open(const char *target) {
+  FILE *out = (target[0] == '|') ? popen(target + 1, "w") : fopen(target, "w");
+  if (out == NULL) return false;
+  flush();
+  lock_guard<mutex> guard(lock);
+  fp = out;
+  pipe = (target[0] == '|');
+  return true;
+}
+
+// Queue a character, starting the thread the first time
+
+void Printer::put(uint8_t byte) {
+  lock_guard<mutex> guard(lock);
+  pending.push_back(byte);
+  if (!thread.joinable()) thread = std::thread(&Printer::run, this);
+  if (pending.size() >= PRINTER_BUFFER) changed.notify_all();
+}
+
+// Wait until everything printed so far has been written out
+
+void Printer::flush() {
+  unique_lock<mutex> guard(lock);
+  if (!thread.joinable()) return;
+  flushing = true;
+  changed.notify_all();
+  changed.wait(guard, [this] { return pending.empty() && !busy; });
+}
+
+Printer::~Printer() {
+  {
+    lock_guard<mutex> guard(lock);
+    stop = true;
+    changed.notify_all();
+  }
+  if (thread.joinable()) thread.join();
+  if (pipe) pclose(fp);
+  else if (fp != stdout) fclose(fp);
+}
+
+// The printer thread: write out whatever has been printed, every so
+// often, or sooner if a lot has built up or it has been asked to
+
+void Printer::run() {
+  unique_lock<mutex> guard(lock);
+  vector<uint8_t> out;
+  while (true) {
+    changed.wait_for(guard, chrono::milliseconds(PRINTER_FLUSH_MS),
+		     [this] { return stop || flushing || pending.size() >= PRINTER_BUFFER; });
+    out.swap(pending);
+    flushing = false;
+    if (out.empty() && stop) return;
+    busy = true;
+    FILE *to = fp;
+    guard.unlock();
+    if (!out.empty()) {
+      fwrite(out.data(), 1, out.size(), to);
+      fflush(to);
+      out.clear();
+    }
+    guard.lock();
+    busy = false;
+    changed.notify_all();
+  }
+}
+
+// Make sure a file (or directory) is on the disk
+
+static bool sync_path(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = (fsync(fd) == 0);
+  close(fd);
+  return ok;
+}
+
+// Give a file the permissions (and if possible the owner) of another,
+// if that exists
+
+static bool copy_mode(const string &from, const string &to) {
+  struct stat st;
+  int source = open(from.c_str(), O_RDONLY);
+  if (source < 0) return errno == ENOENT;
+  bool ok = (fstat(source, &st) == 0);
+  close(source);
+  int fd = open(to.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  if (ok && fchown(fd, st.st_uid, st.st_gid) != 0 && errno != EPERM) ok = false; // EPERM: not root, so keep our own
+  if (ok) ok = (fchmod(fd, st.st_mode & 07777) == 0); // after fchown, which clears set-user-ID
+  close(fd);
+  return ok;
+}
+
+// Write a whole tape to a temporary file next to it, give it the
+// tape's permissions, sync it, and rename it over the tape.  This is
+// done each time the relay goes off after writing, so each flush
+// costs time in proportion to the size of the whole tape, not just
+// what was added (on the writer thread, so the emulation never waits).
+
+static bool replace_tape(const string &file, const vector<uint8_t> &data, tape_sync_t sync) {
+  string temp = file + ".tmp";
+  size_t slash = file.rfind('/');
+  if (is_wav(file)) {
+    if (!write_wav(temp.c_str(), data)) return false;
+  } else {
+    ofstream fs(temp, ios::out | ios::binary | ios::trunc);
+    if (!fs.is_open() || !fs.write((char *)data.data(), data.size())) return false;
+  }
+  if (!copy_mode(file, temp)) return false;
+  if (sync != SYNC_NONE && !sync_path(temp)) return false;
+  if (rename(temp.c_str(), file.c_str()) != 0) return false;
+  if (sync == SYNC_ALL) sync_path(slash == string::npos ? "." : file.substr(0, slash + 1));
+  return true;
+}
+
+// The writer thread: add each lot of bytes to the end of what is in
+// the tape file (which may not exist yet)
+
+void TapeWriter::run() {
+  unique_lock<mutex> guard(lock);
+  while (true) {
+    changed.wait(guard, [this] { return stop || !queue.empty(); });
+    if (queue.empty()) return; // stopping, with nothing left to do
+    Append next = std::move(queue.front());
+    queue.pop_front();
+    busy = true;
+    tape_sync_t policy = sync;
+    guard.unlock();
+    vector<uint8_t> data;
+    if (is_wav(next.file)) read_wav(next.file.c_str(), data);
+    else {
+      ifstream fs(next.file, ios::in | ios::binary);
+      if (fs.is_open()) data.assign(istreambuf_iterator<char>(fs), istreambuf_iterator<char>());
+    }
+    data.insert(data.end(), next.bytes.begin(), next.bytes.end());
+    if (!replace_tape(next.file, data, policy)) {
+      fprintf(stderr, "Tape interface: unable to write %s\n", next.file.c_str());
+    }
+    guard.lock();
+    busy = false;
+    changed.notify_all();
+  }
+}
+
+// Find the programs on a tape.  The monitor looks for 32 carriage
+// returns in a row, then the name up to the END OF TRANSMISSION marker,
+// then loads from 0x1600 up to the end address in the first two bytes.
+
+#define TAPE_LEADER 32
+#define TAPE_NAME_MAX 64
+#define TAPE_LOAD 0x1600
+
+vector<TapeEntry> index_tape(const vector<uint8_t> &data) {
+  vector<TapeEntry> index;
+  TapeEntry entry;
+  size_t i = 0, run, name, end;
+  while (i < data.size()) {
+    if (data[i] != 0x0d) {
+      i++;
+      continue;
+    }
+    for (run=i; i < data.size() && data[i] == 0x0d; i++);
+    if (i - run < TAPE_LEADER) continue;
+    for (name=i; i < data.size() && i - name < TAPE_NAME_MAX && data[i] >= 0x20 && data[i] < 0x7f; i++);
+    if (i + 2 >= data.size() || data[i] != 0x04) continue;
+    end = data[i+1] | data[i+2] << 8;
+    entry.name.assign(data.begin() + name, data.begin() + i);
+    while (!entry.name.empty() && entry.name.back() == ' ') entry.name.pop_back();
+    entry.offset = run;
+    i = min(i + 1 + (end > TAPE_LOAD ? end - TAPE_LOAD : 2), data.size());
+    entry.length = i - run;
+    index.push_back(entry);
+  }
+  return index;
+}
+
+// List the programs on a tape, numbered from 1
+
+void write_tape_index(FILE *fp, const vector<TapeEntry> &index) {
+  size_t i;
+  for (i=0; i<index.size(); i++) {
+    fprintf(fp, "%3zu %-16s offset %6zu length %6zu\n", i + 1, index[i].name.c_str(), index[i].offset, index[i].length);
+  }
+}
+
+// Position the tape at the start of a program, numbered from 1, as if
+// it had been wound there.  Returns the number, or 0 if there is no
+// such program.
+
+int TritonMachine::seek_tape(int program) {
+  if (tape_file.empty() || (!tape_loaded && !load_tape())) return 0;
+  if (program < 1 || program > (int)tape_index.size()) return 0;
+  tape_cursor = tape_index[program-1].offset;
+  return program;
+}
+
+// Wind the tape on to the start of the next program, or back to the
+// start of this one (or the one before if already there), going round
+// the loop if need be.  Returns the number of the program, or 0.
+
+int TritonMachine::step_tape(bool forward) {
+  int i, n;
+  if (tape_file.empty() || (!tape_loaded && !load_tape())) return 0;
+  n = tape_index.size();
+  if (n == 0) return 0;
+  if (forward) {
+    for (i=0; i<n && tape_index[i].offset <= tape_cursor; i++);
+    return seek_tape(i < n ? i + 1 : 1);
+  }
+  for (i=n-1; i>=0 && tape_index[i].offset >= tape_cursor; i--);
+  return seek_tape(i >= 0 ? i + 1 : n);
+}
+
+// How far the tape has been read
+
+uint64_t TritonMachine::tape_position() {
+  return tape_cursor;
+}
+
+// Put the tape back to a position, reading the file again when it is
+// next read from.  Anything being written carries on being collected
+// until the relay goes off.
+
+void TritonMachine::restore_tape(uint64_t position) {
+  tape_loaded = false;
+  tape_cursor = position;
+}
+
+// After the machine has been put back into an earlier state, forget
+// anything worked out from the state it was in
+
+void TritonMachine::restored() {
+  FlushCache8080(&state);
+  memset(bus.dirty, 1, sizeof(bus.dirty));
+  poll_valid = false;
+  polling = false;
+}
+
+// Save the state of the machine
+
+void TritonMachine::save_state(vector<uint8_t> &data) {
+  data.assign(STATE_MAGIC, STATE_MAGIC + 4);
+  put(data, STATE_VERSION, 2);
+  put(data, mem_top, 2);
+  save_latches(this, data);
+  data.insert(data.end(), memory, memory + _64K);
+}
+
+// Restore a saved state, returning false (leaving the machine as it
+// was) if it is not one, or not this version
+
+bool TritonMachine::load_state(const vector<uint8_t> &data) {
+  StateReader in = {data.data(), data.data() + data.size(), true};
+  Latches latches;
+  uint16_t top;
+  if (data.size() < 4 || memcmp(data.data(), STATE_MAGIC, 4) != 0) return false;
+  in.p += 4;
+  if (get(in, 2) != STATE_VERSION) return false;
+  top = get(in, 2);
+  if (!in.ok || !valid_mem_top(top)) return false;
+  if (!read_latches(this, in, latches) || in.end - in.p != _64K) return false;
+  restore_latches(this, latches);
+  memcpy(memory, in.p, _64K);
+  if (top != mem_top) { // map the RAM again
+    MapPages8080(&bus, 0x1400, max(top, mem_top), PAGE_ROM);
+    MapPages8080(&bus, 0x1400, top, PAGE_RAM);
+    mem_top = top;
+  }
+  restored();
+  return true;
+}
+
+bool TritonMachine::save_state(const char *file) {
+  vector<uint8_t> data;
+  save_state(data);
+  ofstream fs(file, ios::out | ios::binary);
+  if (!fs.is_open()) {
+    fprintf(stderr, "Unable to open %s to save the state\n", file);
+    return false;
+  }
+  fs.write((char *)data.data(), data.size());
+  return fs.good();
+}
+
+bool TritonMachine::load_state(const char *file) {
+  ifstream fs(file, ios::in | ios::binary);
+  if (!fs.is_open()) {
+    fprintf(stderr, "Unable to open saved state %s\n", file);
+    return false;
+  }
+  vector<uint8_t> data((istreambuf_iterator<char>(fs)), istreambuf_iterator<char>());
+  if (!load_state(data)) {
+    fprintf(stderr, "%s is not a saved state, or is from another version\n", file);
+    return false;
+  }
+  return true;
+}
+
+// The bytes taken up by a snapshot
+
+size_t History::size(const Snapshot &snapshot) {
+  return sizeof(Snapshot) + snapshot.pages.size() + snapshot.eprom.size() * sizeof(StateEPROM);
+}
+
+static bool same_eprom(const StateEPROM &a, const StateEPROM &b) {
+  return a.a == b.a && a.b == b.b && a.c == b.c && a.ctl == b.ctl
+    && a.chip_select == b.chip_select && a.write_enable == b.write_enable
+    && a.failed == b.failed && a.portA_dirn == b.portA_dirn
+    && memcmp(a.rom, b.rom, _1K) == 0 && memcmp(a.write_count, b.write_count, sizeof(a.write_count)) == 0;
+}
+
+// Take a snapshot, comparing memory with the last one to find the
+// pages which have changed
+
+void History::snapshot(TritonMachine *machine) {
+  Snapshot snapshot;
+  int page;
+  SyncFlags8080(&machine->state);
+  snapshot.state = machine->state;
+  snapshot.io = machine->io;
+  snapshot.tape_position = machine->tape_position();
+  if (snapshots.empty()) {
+    shadow.assign(machine->memory, machine->memory + _64K);
+    shadow_eprom = machine->eprom;
+  } else {
+    for (page=0; page<256; page++) {
+      uint8_t *now = &machine->memory[page << 8];
+      uint8_t *then = &shadow[page << 8];
+      if (memcmp(now, then, 256) != 0) {
+	snapshot.pages.push_back(page);
+	snapshot.pages.insert(snapshot.pages.end(), then, then + 256);
+	memcpy(then, now, 256);
+      }
+    }
+    if (!same_eprom(machine->eprom, shadow_eprom)) {
+      snapshot.eprom.push_back(shadow_eprom);
+      shadow_eprom = machine->eprom;
+    }
+  }
+  total += size(snapshot);
+  snapshots.push_back(std::move(snapshot));
+  while (total > budget && snapshots.size() > 1) {
+    total -= size(snapshots.front());
+    snapshots.pop_front();
+  }
+  at_snapshot = false;
+}
+
+// Put the machine back to the last snapshot, or if it is there already
+// the one before, undoing the changes to memory since then.  Returns
+// false if there is nothing to go back to.
+
+bool History::step_back(TritonMachine *machine) {
+  size_t i;
+  if (snapshots.empty()) return false;
+  if (at_snapshot) {
+    Snapshot &last = snapshots.back();
+    if (snapshots.size() < 2) return false;
+    for (i=0; i<last.pages.size(); i+=257) {
+      memcpy(&shadow[last.pages[i] << 8], &last.pages[i + 1], 256);
+    }
+    if (!last.eprom.empty()) shadow_eprom = last.eprom[0];
+    total -= size(last);
+    snapshots.pop_back();
+  }
+  const Snapshot &snapshot = snapshots.back();
+  State8080 state = snapshot.state;
+  state.cache = machine->state.cache;
+  state.profile = machine->state.profile;
+  machine->state = state;
+  machine->io = snapshot.io;
+  char *eprom_file = machine->eprom.file;
+  machine->eprom = shadow_eprom;
+  machine->eprom.file = eprom_file;
+  memcpy(machine->memory, shadow.data(), _64K);
+  machine->restore_tape(snapshot.tape_position);
+  machine->restored();
+  at_snapshot = true;
+  return true;
+}
+
+void History::clear() {
+  snapshots.clear();
+  total = 0;
+  at_snapshot = false;
+}
+
+// Input logs are text, with comments starting with '#' and then one
+// event to a line: the cycle count, the type and the byte in hex
+
+bool InputLog::save(const char *file) {
+  FILE *fp = fopen(file, "w");
+  size_t i;
+  if (fp == NULL) {
+    fprintf(stderr, "Unable to open input log %s for writing\n", file);
+    return false;
+  }
+  fprintf(fp, "# Triton input log: cycles, k(ey) u(p) i(nterrupt) r(eset) t(ape), byte\n");
+  for (i=0; i<events.size(); i++) {
+    fprintf(fp, "%llu %c %02x\n", events[i].cycles, events[i].type, events[i].byte);
+  }
+  fclose(fp);
+  return true;
+}
+
+bool InputLog::load(const char *file) {
+  ifstream fs(file);
+  string line;
+  int n = 0;
+  if (!fs.is_open()) {
+    fprintf(stderr, "Unable to open input log %s\n", file);
+    return false;
+  }
+  events.clear();
+  next_tape = 0;
+  while (getline(fs, line)) {
+    InputEvent event;
+    unsigned int byte;
+    n++;
+    if (line.empty() || line[0] == '#') continue;
+    if (sscanf(line.c_str(), "%llu %c %x", &event.cycles, &event.type, &byte) != 3
+	|| strchr("kuirt", event.type) == NULL) {
+      fprintf(stderr, "%s:%d: not an input event\n", file, n);
+      return false;
+    }
+    event.byte = byte;
+    events.push_back(event);
+  }
+  return true;
+}
+
+void InputLog::add(unsigned long long cycles, char type, uint8_t byte) {
+  InputEvent event = {cycles, type, byte};
+  events.push_back(event);
+}
+
+// The next byte read from tape, or 0xff once they have all been read
+// as if from the end of the tape
+
+uint8_t InputLog::tape_byte(unsigned long long cycles) {
+  while (next_tape < events.size() && events[next_tape].type != 't') next_tape++;
+  if (next_tape == events.size()) return 0xff;
+  if (events[next_tape].cycles != cycles && !diverged) {
+    fprintf(stderr, "Input log: tape read at cycle %llu, recorded at %llu\n", cycles, events[next_tape].cycles);
+    diverged = true;
+  }
+  return events[next_tape++].byte;
+}
+
+// Type a keystroke script: each byte is a key, a newline is sent as a
+// carriage return, \w waits for a second and \\ is a backslash.  The
+// slow VDU routine in the monitor ignores keys typed while it is
+// printing, so menus need time to appear.  Returns false if run_for
+// stopped it.
+
+bool type_keys(TritonMachine *machine, const string &keys,
+	       const function<bool(unsigned long long cycles)> &run_for) {
+  size_t i;
+  for (i=0; i<keys.size(); i++) {
+    uint8_t byte = keys[i];
+    if (byte == '\\' && i + 1 < keys.size()) {
+      if (keys[++i] == 'w') {
+	if (!run_for(WAIT_CYCLES)) return false;
+	continue;
+      }
+      byte = keys[i];
+    }
+    if (byte == '\n') byte = 0x0d;
+    machine->key_press(byte, true);
+    if (!run_for(KEY_CYCLES)) return false;
+    machine->key_press(byte, false);
+    if (!run_for(KEY_CYCLES)) return false;
+    if (byte == 0x0d && !run_for(WAIT_CYCLES)) return false;
+  }
+  return true;
+}
+
+// Apply a key, interrupt or reset event to a machine
+
+void InputLog::apply(TritonMachine *machine, const InputEvent &event) {
+  switch (event.type) {
+  case 'k': machine->key_press(event.byte, true); break;
+  case 'u': machine->key_press(event.byte, false); break;
+  case 'i': machine->interrupt(event.byte); break;
+  case 'r': machine->reset(); break;
+  }
+}
+
+// Read symbols from one or more variable lists as printed by 'trimcc
+// -v' (separate the filenames by a comma).  Only the lines after the
+// heading are used, and END and undefined variables are skipped.
+
+bool load_symbols(const char *symbol_files, SymbolTable &symbols) {
+  string files = symbol_files;
+  size_t start = 0, comma;
+  bool ok = true;
+  do {
+    comma = files.find(',', start);
+    string file = files.substr(start, comma == string::npos ? string::npos : comma - start);
+    ifstream fs(file);
+    string line;
+    bool listing = false;
+    if (!fs.is_open()) {
+      fprintf(stderr, "Unable to open symbol file %s\n", file.c_str());
+      ok = false;
+    }
+    while (getline(fs, line)) {
+      char name[256];
+      unsigned int hex, decimal;
+      if (line.find(" hex  decimal") == 0) listing = true;
+      else if (listing && sscanf(line.c_str(), "%4x %u %255s", &hex, &decimal, name) == 3
+	       && hex == decimal && hex < _64K && line.find("[*****]") == string::npos
+	       && strcmp(name, "END") != 0) symbols[hex] = name;
+    }
+    start = comma + 1;
+  } while (comma != string::npos);
+  return ok;
+}
+
+// The nearest symbol at or below an address, with the offset from it
+
+static string symbolise(const SymbolTable &symbols, uint16_t address, bool offset) {
+  char text[16];
+  auto it = symbols.upper_bound(address);
+  if (it == symbols.begin()) return "-";
+  --it;
+  if (!offset || it->first == address) return it->second;
+  snprintf(text, sizeof(text), "+%X", address - it->first);
+  return it->second + text;
+}
+
+// Write a profile sorted by cycles: the time in each routine (from
+// one symbol to the next), at each address, and for each op code
+
+void write_profile(FILE *fp, const Profile8080 *profile, const SymbolTable &symbols) {
+  unsigned long long count = 0, cycles = 0;
+  map<string, pair<unsigned long long, unsigned long long>> routines;
+  vector<int> addresses, ops;
+  int i;
+  for (i=0; i<_64K; i++) if (profile->count[i]) {
+    count += profile->count[i];
+    cycles += profile->cycles[i];
+    addresses.push_back(i);
+    auto &routine = routines[symbolise(symbols, i, false)];
+    routine.first += profile->count[i];
+    routine.second += profile->cycles[i];
+  }
+  for (i=0; i<256; i++) if (profile->op_count[i]) ops.push_back(i);
+  if (cycles == 0) cycles = 1;
+  fprintf(fp, "Profile: %llu instructions, %llu cycles\n", count, cycles);
+
+  vector<pair<string, pair<unsigned long long, unsigned long long>>> by_routine(routines.begin(), routines.end());
+  sort(by_routine.begin(), by_routine.end(), [](const auto &a, const auto &b) { return a.second.second > b.second.second; });
+  fprintf(fp, "\nRoutines by cycles\n\n%14s %6s %14s  %s\n", "cycles", "%", "instructions", "routine");
+  for (auto &routine : by_routine) {
+    fprintf(fp, "%14llu %6.2f %14llu  %s\n", routine.second.second, 100.0 * routine.second.second / cycles,
+	    routine.second.first, routine.first.c_str());
+  }
+
+  sort(addresses.begin(), addresses.end(), [profile](int a, int b) { return profile->cycles[a] > profile->cycles[b]; });
+  fprintf(fp, "\nAddresses by cycles\n\n%4s %14s %6s %14s  %s\n", "addr", "cycles", "%", "instructions", "symbol");
+  for (int address : addresses) {
+    fprintf(fp, "%04X %14llu %6.2f %14llu  %s\n", address, profile->cycles[address],
+	    100.0 * profile->cycles[address] / cycles, profile->count[address],
+	    symbolise(symbols, address, true).c_str());
+  }
+
+  sort(ops.begin(), ops.end(), [profile](int a, int b) { return profile->op_cycles[a] > profile->op_cycles[b]; });
+  fprintf(fp, "\nOp codes by cycles\n\n%4s %14s %6s %14s\n", "op", "cycles", "%", "instructions");
+  for (int op : ops) {
+    fprintf(fp, "  %02X %14llu %6.2f %14llu\n", op, profile->op_cycles[op],
+	    100.0 * profile->op_cycles[op] / cycles, profile->op_count[op]);
+  }
+}
@@ -0,0 +1,310 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* The Transam Triton as a self-contained machine: memory, processor,
+ * I/O ports, EPROM programmer and tape.  Nothing here depends on the
+ * display, so several machines can be run side by side, each on its
+ * own thread.
+ */
+
+#ifndef _MACHINE_HPP
+#define _MACHINE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "8080.hpp"
+
+#define _1K 0x400
+#define _8K 0x2000
+#define _64K 0x10000
+
+#define MEM_TOP_DEFAULT 0x2000
+
+// One microcycle is 1.25uS = effective clock rate of 800kHz.  When a
+// keystroke script is typed (see type_keys) the monitor is given
+// three seconds to start up, keys are held down and released for
+// 50ms, and a carriage return or \w is followed by a second's wait.
+
+#define CYCLES_PER_SECOND 800000
+#define BOOT_CYCLES (3 * CYCLES_PER_SECOND)
+#define KEY_CYCLES 40000
+#define WAIT_CYCLES CYCLES_PER_SECOND
+#define MEM_TOP_MIN 0x1400 // the end of the VDU memory, so no user RAM
+#define MEM_TOP_MAX 0xff00 // the last page boundary that fits in 16 bits
+
+typedef enum {INPUT, OUTPUT} direction_t;
+
+typedef struct StateEPROM {
+  char *file = NULL;
+  uint8_t a, b, c, ctl;
+  uint8_t rom[_1K];
+  int write_count[_1K];
+  bool chip_select = false;
+  bool write_enable = false;
+  bool failed = false;
+  direction_t portA_dirn = OUTPUT;
+} StateEPROM;
+
+class IOState {
+public:
+  int  key_buffer;
+  uint8_t led_buffer;
+  int  vdu_buffer;
+  unsigned int port6_bit_count;
+  uint8_t print_byte;
+  bool oscillator;
+  bool tape_relay;
+  int  cursor_position;
+  int  tape_status;
+  int  uart_status;
+  int  vdu_startrow;
+  void vdu_strobe(State8080 *state, Bus8080 *bus);
+};
+
+void load_rom(uint8_t *memory, const char *rom_name, uint16_t rom_start, uint16_t rom_size);
+void UV_erase(StateEPROM *eprom);
+bool check_write_counts(StateEPROM *eprom);
+bool valid_mem_top(unsigned long top);
+bool parse_mem_top(const char *arg, uint16_t &top);
+
+typedef std::map<uint16_t, std::string> SymbolTable;
+
+bool load_symbols(const char *symbol_files, SymbolTable &symbols);
+void write_profile(FILE *fp, const Profile8080 *profile, const SymbolTable &symbols);
+
+// A switch of the oscillator on port 7, for the sound to follow
+
+typedef struct ToneChange {
+  unsigned long long cycles;
+  bool on;
+  bool restart; // the cycle count has jumped (a restore or rewind), so start again from here
+} ToneChange;
+
+class TritonMachine;
+
+// Input recorded against the cycle count so that it can be replayed
+// exactly: key presses and releases, interrupts and resets, and the
+// bytes read from tape.  While a machine is replaying, the bytes read
+// from tape are taken from the log, in order.
+
+typedef struct InputEvent {
+  unsigned long long cycles;
+  char type; // 'k' key press, 'u' key release, 'i' interrupt, 'r' reset, 't' tape read
+  uint8_t byte;
+} InputEvent;
+
+class InputLog {
+public:
+  std::vector<InputEvent> events;
+  bool save(const char *file);
+  bool load(const char *file);
+  void add(unsigned long long cycles, char type, uint8_t byte);
+  uint8_t tape_byte(unsigned long long cycles);
+  static void apply(TritonMachine *machine, const InputEvent &event);
+private:
+  size_t next_tape = 0;
+  bool diverged = false;
+};
+
+// A program on the tape, found from its header (see TRIMCC.md): the
+// offset is that of the first carriage return of the header, and the
+// length takes in the header and the program.
+
+typedef struct TapeEntry {
+  std::string name;
+  size_t offset;
+  size_t length;
+} TapeEntry;
+
+std::vector<TapeEntry> index_tape(const std::vector<uint8_t> &data);
+void write_tape_index(FILE *fp, const std::vector<TapeEntry> &index);
+
+// Bytes written to tape are added to the tape file on a thread of its
+// own, so that the emulation never waits for the disk.  Each lot is
+// added by writing the whole tape to a temporary file, which is synced
+// according to the policy and then renamed over the tape, so a crash
+// leaves either the old tape or the new one, never half of one.
+
+typedef enum {SYNC_NONE, SYNC_FILE, SYNC_ALL} tape_sync_t; // SYNC_ALL syncs the directory too
+
+class TapeWriter {
+public:
+  tape_sync_t sync = SYNC_FILE;
+  TapeWriter() = default;
+  ~TapeWriter();
+  void append(const std::string &file, std::vector<uint8_t> &bytes);
+  void wait();
+private:
+  typedef struct Append {
+    std::string file;
+    std::vector<uint8_t> bytes;
+  } Append;
+  std::deque<Append> queue;
+  std::mutex lock;
+  std::condition_variable changed;
+  std::thread thread;
+  bool busy = false;
+  bool stop = false;
+  void run();
+};
+
+// The printer.  Characters are collected as they are printed, and a
+// thread of its own writes them out, every so often or whenever
+// enough have built up, so the emulation never waits for the file or
+// pipe.  Output goes to stdout unless it is sent somewhere else.
+
+class Printer {
+public:
+  Printer() = default;
+  ~Printer();
+  bool open(const char *target); // a file, or |command for a pipe
+  void put(uint8_t byte);
+  void flush();
+private:
+  FILE *fp = stdout;
+  bool pipe = false;
+  std::vector<uint8_t> pending;
+  std::mutex lock;
+  std::condition_variable changed;
+  std::thread thread;
+  bool busy = false;
+  bool flushing = false;
+  bool stop = false;
+  void run();
+};
+
+class TritonMachine {
+public:
+  uint8_t memory[_64K];
+  State8080 state;
+  Bus8080 bus;
+  IOState io;
+  StateEPROM eprom;
+  std::vector<uint8_t> tape_written; // since the relay went on, not yet handed to the writer
+  TapeWriter tape_writer;
+  std::string tape_file; // empty if there is no tape
+  std::vector<uint8_t> tape_data; // the tape file, read in full
+  size_t tape_cursor = 0; // how far it has been read, kept while the relay is off
+  bool tape_loaded = false; // tape_data is up to date
+  std::vector<TapeEntry> tape_index; // the programs on the tape, found when it is loaded
+  bool fast_tape = false; // copy programs from tape in one go (see fast_load)
+  bool fast_print = false; // print characters in one go (see print_char)
+  Printer printer;
+  uint16_t mem_top;
+  bool detect_polling = false; // look out for the keyboard being polled
+  bool polling = false; // the last run only polled the keyboard
+  InputLog *recording = NULL; // log input here
+  InputLog *replaying = NULL; // read from tape from here
+  std::vector<ToneChange> *tone_changes = NULL; // log the oscillator switching here
+  TritonMachine(uint16_t mem_top = MEM_TOP_DEFAULT);
+  ~TritonMachine();
+  TritonMachine(const TritonMachine &) = delete;
+  TritonMachine &operator=(const TritonMachine &) = delete;
+  void load_roms(const char *user_roms);
+  void reset();
+  void key_press(uint8_t byte, bool pressed);
+  void interrupt(uint8_t rst);
+  void in_out();
+  bool run(int cycles);
+  uint16_t vdu_changes();
+  void save_state(std::vector<uint8_t> &data);
+  bool load_state(const std::vector<uint8_t> &data);
+  bool save_state(const char *file);
+  bool load_state(const char *file);
+  bool load_tape();
+  void flush_tape();
+  uint64_t tape_position();
+  int seek_tape(int program);
+  int step_tape(bool forward);
+  void restore_tape(uint64_t position);
+  void restored();
+private:
+  bool poll_valid = false;
+  State8080 poll_state; // at the first read of the keyboard in the last run
+  int poll_key;
+  bool poll_other_io; // I/O other than reading the keyboard since then
+  std::vector<uint8_t> poll_memory; // VDU memory and RAM at the same point
+  bool keyboard_poll();
+  void fast_load();
+  bool print_char();
+};
+
+// A history of snapshots, taken say once a frame, so that the machine
+// can be stepped back through them.  A snapshot keeps the processor,
+// the I/O latches and the tape position, and undo records for the
+// 256-byte pages of memory (and the EPROM) which changed since the
+// snapshot before: their contents as they were then.  The oldest
+// snapshots are dropped to keep within a budget of bytes.
+
+class History {
+public:
+  History(size_t budget) : budget(budget) {}
+  void snapshot(TritonMachine *machine);
+  bool step_back(TritonMachine *machine);
+  void clear();
+  size_t count() const { return snapshots.size(); }
+  size_t bytes() const { return total; }
+private:
+  typedef struct Snapshot {
+    State8080 state;
+    IOState io;
+    uint64_t tape_position;
+    std::vector<StateEPROM> eprom; // the EPROM before this snapshot, if it changed
+    std::vector<uint8_t> pages; // page numbers each followed by 256 bytes, as before this snapshot
+  } Snapshot;
+  std::deque<Snapshot> snapshots;
+  std::vector<uint8_t> shadow; // memory at the last snapshot
+  StateEPROM shadow_eprom; // and the EPROM
+  bool at_snapshot = false; // the machine has just been stepped back to the last snapshot
+  size_t budget;
+  size_t total = 0;
+  static size_t size(const Snapshot &snapshot);
+};
+
+// Type a keystroke script, with run_for running the machine between
+// keys; it returns false to stop typing
+
+bool type_keys(TritonMachine *machine, const std::string &keys,
+	       const std::function<bool(unsigned long long cycles)> &run_for);
+
+#endif
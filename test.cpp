@@ -0,0 +1,209 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Tests for the emulator core and the tape audio
+ * Each test sets up a small case, runs it and checks the outcome,
+ * printing 'ok' or what went wrong.  The exit status is the number
+ * of failures.  Build with -fsanitize=address (make test-asan) to
+ * catch memory errors as well.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "8080.hpp"
+#include "kcs.hpp"
+
+using namespace std;
+
+// A program which overwrites an op code further on in the block it
+// is running from.  The NOP at 0006 becomes INR A, so A ends up as
+// 3D; running the stale block would leave it at 3C.
+
+static const uint8_t self_modify[] = {
+  0x3e, 0x3c,       // 0000 MVI A,3C (the op code for INR A)
+  0x32, 0x06, 0x00, // 0002 STA 0006
+  0x00,             // 0005 NOP
+  0x00,             // 0006 NOP, to be overwritten
+  0x76,             // 0007 HLT
+};
+
+static bool test_self_modify() {
+  static uint8_t memory[0x10000];
+  State8080 state = {};
+  Bus8080 bus = {};
+  memset(memory, 0, sizeof(memory));
+  memcpy(memory, self_modify, sizeof(self_modify));
+  InitBus8080(&bus, memory);
+  MapPages8080(&bus, 0x0000, 0x0100, PAGE_RAM);
+  Reset8080(&state);
+  EnableCache8080(&state, true);
+  Stop8080 stop = Run8080(&state, &bus, 1000);
+  EnableCache8080(&state, false);
+  if (stop != STOP_HALT || state.a != 0x3d || state.instructions != 5) {
+    printf("A=%02X after %llu instructions\n", state.a, state.instructions);
+    return false;
+  }
+  return true;
+}
+
+// A short tape with a header, for the audio tests
+
+static const vector<uint8_t> test_tape = {0x0d, 0x0d, 'T', 'E', 'S', 'T', 0x04, 0x00, 0x17, 0xff};
+
+// A tape as audio which starts part way through a cycle of the
+// leader, with the first sample well above the threshold, should
+// still decode
+
+static bool test_wav_mid_cycle() {
+  vector<uint8_t> bytes = test_tape, decoded;
+  vector<int16_t> samples;
+  kcs_encode(bytes, KCS_RATE_DEFAULT, samples);
+  samples.erase(samples.begin(), samples.begin() + 5); // near the top of a cycle
+  KcsDecoder decoder(KCS_RATE_DEFAULT);
+  decoder.decode(samples.data(), samples.size(), decoded);
+  if (samples[0] < 10000 || decoded != bytes || decoder.errors) {
+    printf("first sample %d, %zu bytes decoded, %lu errors\n", samples[0], decoded.size(), decoder.errors);
+    return false;
+  }
+  return true;
+}
+
+// Write 16 bit mono samples as a WAV file and read them back.  The
+// format chunk is plain PCM, or WAVE_FORMAT_EXTENSIBLE with the given
+// SubFormat GUID (its first two bytes, the rest being the standard
+// ones), and may come before or after the data chunk.
+
+#define TEST_WAV "/tmp/triton-test.wav"
+#define SUBTYPE_NONE 0 // plain PCM
+#define SUBTYPE_PCM 1
+#define SUBTYPE_FLOAT 3
+
+static void put_le(vector<uint8_t> &data, uint32_t value, int bytes) {
+  for (int i=0; i<bytes; i++) data.push_back((value >> (8 * i)) & 0xff);
+}
+
+static bool wav_round_trip(const vector<int16_t> &samples, int subtype, bool format_first,
+			   vector<uint8_t> &bytes) {
+  const uint8_t guid_tail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+  vector<uint8_t> format, data, wav;
+  put_le(format, subtype == SUBTYPE_NONE ? 1 : 0xfffe, 2);
+  put_le(format, 1, 2); // mono
+  put_le(format, KCS_RATE_DEFAULT, 4);
+  put_le(format, 2 * KCS_RATE_DEFAULT, 4);
+  put_le(format, 2, 2);
+  put_le(format, 16, 2);
+  if (subtype != SUBTYPE_NONE) {
+    put_le(format, 22, 2); // the size of the extension
+    put_le(format, 16, 2); // valid bits
+    put_le(format, 0, 4); // channel mask
+    put_le(format, subtype, 2);
+    format.insert(format.end(), guid_tail, guid_tail + 14);
+  }
+  for (int16_t sample : samples) put_le(data, (uint16_t)sample, 2);
+  wav.insert(wav.end(), {'R', 'I', 'F', 'F'});
+  put_le(wav, 4 + 8 + format.size() + 8 + data.size(), 4);
+  wav.insert(wav.end(), {'W', 'A', 'V', 'E'});
+  for (int chunk=0; chunk<2; chunk++) {
+    if ((chunk == 0) == format_first) {
+      wav.insert(wav.end(), {'f', 'm', 't', ' '});
+      put_le(wav, format.size(), 4);
+      wav.insert(wav.end(), format.begin(), format.end());
+    } else {
+      wav.insert(wav.end(), {'d', 'a', 't', 'a'});
+      put_le(wav, data.size(), 4);
+      wav.insert(wav.end(), data.begin(), data.end());
+    }
+  }
+  ofstream fs(TEST_WAV, ios::out | ios::binary | ios::trunc);
+  fs.write((char *)wav.data(), wav.size());
+  fs.close();
+  bool ok = read_wav(TEST_WAV, bytes);
+  remove(TEST_WAV);
+  return ok;
+}
+
+// A WAV file with audio in it but no tape data is an error
+
+static bool test_wav_no_data() {
+  vector<int16_t> silence(100);
+  vector<uint8_t> bytes;
+  return !wav_round_trip(silence, SUBTYPE_NONE, true, bytes);
+}
+
+// WAVE_FORMAT_EXTENSIBLE is read if it holds integer PCM, and refused
+// if it holds anything else (floats, here)
+
+static bool test_wav_extensible() {
+  vector<int16_t> samples;
+  vector<uint8_t> bytes;
+  kcs_encode(test_tape, KCS_RATE_DEFAULT, samples);
+  if (!wav_round_trip(samples, SUBTYPE_PCM, true, bytes) || bytes != test_tape) return false;
+  return !wav_round_trip(samples, SUBTYPE_FLOAT, true, bytes);
+}
+
+// The format chunk may come after the data
+
+static bool test_wav_format_last() {
+  vector<int16_t> samples;
+  vector<uint8_t> bytes;
+  kcs_encode(test_tape, KCS_RATE_DEFAULT, samples);
+  return wav_round_trip(samples, SUBTYPE_NONE, false, bytes) && bytes == test_tape;
+}
+
+typedef struct Test {
+  const char *name;
+  bool (*run)();
+} Test;
+
+static const Test tests[] = {
+  {"self-modifying code in a cached block", test_self_modify},
+  {"tape audio starting mid-cycle", test_wav_mid_cycle},
+  {"tape audio with no data", test_wav_no_data},
+  {"tape audio in an extensible WAV file", test_wav_extensible},
+  {"tape audio with the format after the data", test_wav_format_last},
+};
+
+int main(int argc, char** argv) {
+  int failures = 0;
+  for (const Test &test : tests) {
+    bool ok = test.run();
+    printf("%s: %s\n", test.name, ok ? "ok" : "FAILED");
+    if (!ok) failures++;
+  }
+  return failures;
+}
@@ -43,138 +43,27 @@
 
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
-#include "8080.hpp"
+#include "machine.hpp"
+#include "handoff.hpp"
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <cstring>
 #include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <unistd.h>
 
-#define _1K 0x400
-#define _8K 0x2000
-#define _64K 0x10000
-
-uint16_t mem_top;
-
-typedef enum {INPUT, OUTPUT} direction_t;
-
-typedef struct StateEPROM {
-  char *file = NULL;
-  uint8_t a, b, c, ctl;
-  uint8_t rom[_1K];
-  int write_count[_1K];
-  bool chip_select = false;
-  bool write_enable = false;
-  bool failed = false;
-  direction_t portA_dirn = OUTPUT;
-} StateEPROM;
-
-// #define PRINTF_HI(byte) for (int i=7; i>=4; i--) printf("%c", (byte >> i) & 1 ? '1' : '0')
-// #define PRINTF_LO(byte) for (int i=3; i>=0; i--) printf("%c", (byte >> i) & 1 ? '1' : '0')
-// #define PRINTF_BIN(byte) printf("%02X (", byte); PRINTF_HI(byte); PRINTF_LO(byte); printf(")")
-
-// void WriteStatusEPROM(FILE *fp, StateEPROM *eprom) {
-//   fprintf(fp, "A/FC="); PRINTF_BIN(eprom->a);
-//   fprintf(fp, " B/FD="); PRINTF_BIN(eprom->b);
-//   fprintf(fp, " C/FE="); PRINTF_BIN(eprom->c);
-//   fprintf(fp, " ctrl="); PRINTF_BIN(eprom->ctl);
-// }
-
 using namespace std;
 
-class IOState {
-public:
-  int  key_buffer;
-  uint8_t led_buffer;
-  int  vdu_buffer;
-  unsigned int port6_bit_count;
-  uint8_t print_byte;
-  bool oscillator;
-  bool tape_relay;
-  int  cursor_position;
-  int  tape_status;
-  int  uart_status;
-  int  vdu_startrow;
-  void vdu_strobe(State8080 *state, uint8_t *memory);
-  void key_press(sf::Event::EventType event, int key, bool shifted, bool ctrl);
-};
-
-const int mem_top_default = 0x2000;
-
-char *tape_file = NULL;
-char *user_rom = NULL;
-
 const char *core_dump = "core";
+const char *state_file_default = "triton.sav";
 
-// Takes input from port 5 buffer (IC 51) and attempts to duplicate
-// Thomson-CSF VDU controller (IC 61) interface with video RAM
-
-void IOState::vdu_strobe(State8080 *state, uint8_t *memory) {
-  int i;
-  int input = vdu_buffer & 0x7f;
-  switch(input) {
-  case 0x00: break; // NUL
-  case 0x04: break; // EOT (End of Text)
-  case 0x08: // Backspace
-    if (--cursor_position < 0) cursor_position += 1024;
-    break;
-  case 0x09: // Step cursor RIGHT
-    if (++cursor_position >= 1024) cursor_position -= 1024;
-    break;
-  case 0x0a: // Line feed
-    cursor_position += 64;
-    if (cursor_position >= 1024) {
-      cursor_position -= 64;
-      if (++vdu_startrow > 15) vdu_startrow = 0;
-      for (i=0; i<64; i++) {
-	memory[0x1000 + (((64 * vdu_startrow) + cursor_position + i) % 1024)] = 0x20;
-      }
-    }
-    break;
-  case 0x0b: // Step cursor UP
-    cursor_position -=64;
-    if (cursor_position < 0) cursor_position += 1024;
-    break;
-  case 0x0c: // Clear screen/reset cursor
-    for (i=0; i<1024; i++) memory[0x1000 + i] = 0x20;
-    cursor_position = 0;
-    vdu_startrow = 0;
-    break;
-  case 0x0d: // Carriage return / clear line
-    if (cursor_position % 64 != 0) {
-      while(cursor_position % 64 != 0) {
-	memory[0x1000 + (((64 * vdu_startrow) + cursor_position++) % 1024)] = 0x20;
-      }
-      cursor_position -= 64;
-    }
-    break;
-  case 0x1b: // Screen roll (changes which memory location represents top of screen)
-    if (++vdu_startrow > 15) vdu_startrow = 0;
-    cursor_position -= 64;
-    if (cursor_position < 0) cursor_position += 1024;
-    break;
-  case 0x1c: // Reset cursor
-    cursor_position = 0;
-    break;
-  case 0x1d: // Carriage return (no clear)
-    cursor_position -= (cursor_position % 64);
-    break;
-  default:
-    memory[0x1000 + (((64 * vdu_startrow) + cursor_position) % 1024)] = input;
-    if (++cursor_position >= 1024) {
-      cursor_position -= 64;
-      if (++vdu_startrow > 15) vdu_startrow = 0;
-      for (i=0; i<64; i++) {
-	memory[0x1000 + (((64 * vdu_startrow) + cursor_position + i) % 1024)] = 0x20;
-      }
-    }
-    break;
-  }
-}
+// Translates keyboard input to the byte for port 0 (IC 49), or 0xFF
+// if the key is not recognised
 
-void IOState::key_press(sf::Event::EventType event, int key, bool shifted, bool ctrl) {
-  // Handles keyboard input, placing data in port 0 (IC 49)
+uint8_t key_code(int key, bool shifted, bool ctrl) {
   // Assumes PC has UK keyboard - because that's all I have to test it with!
   uint8_t byte = 0xFF;
   if (ctrl == false) {
@@ -237,246 +126,438 @@ void IOState::key_press(sf::Event::EventType event, int key, bool shifted, bool
     case sf::Keyboard::RBracket: byte = 0x1D; break; // control + right bracket
     }
   }
-  if (byte != 0xFF) { // check if the key press was recognised
-    key_buffer = byte; // set the key buffer
-    if (event == sf::Event::KeyPressed) key_buffer |= 0x80; // set the strobe bit
+  return byte;
+}
+
+// Print help about the function keys
+
+void print_help(FILE *fp) {
+  fprintf(fp, "\nFunction Keys -- whilst emulation running\n\n");
+  fprintf(fp, "F1: interrupt 1 (RST 1) - clear screen\n");
+  fprintf(fp, "F2: interrupt 2 (RST 2) - save and dump registers\n");
+  fprintf(fp, "F3: reset (RST 0)\n\n");
+  fprintf(fp, "F4: write the EPROM to the file specified by -z\n");
+  fprintf(fp, "shift + F4: toggle simulation of READ ERROR failure mode\n");
+  fprintf(fp, "ctrl + shift + F4: UV erase the EPROM (set all bytes to 0xff)\n\n");
+  fprintf(fp, "F5: toggle emulator pause\n");
+  fprintf(fp, "shift + F5: write 8080 status to command line\n");
+  fprintf(fp, "ctrl + shift + F5: dump core\n\n");
+  fprintf(fp, "F6: toggle turbo mode (run as fast as possible)\n\n");
+  fprintf(fp, "F7: save the state of the machine to the file given by -l (or %s)\n", state_file_default);
+  fprintf(fp, "shift + F7: restore the saved state\n\n");
+  fprintf(fp, "F8: rewind while held down, or step back a frame when paused\n\n");
+  fprintf(fp, "F9: print help about the function keys\n");
+  fprintf(fp, "F10: wind the tape on to the next program\n");
+  fprintf(fp, "shift + F10: wind the tape back to the start of the program\n");
+  fprintf(fp, "ctrl + shift + F9: exit emulator\n");
+}
+
+// The screen is drawn as a single array of quads, four vertices to a
+// character cell, all textured from the font.  Point the quad for one
+// cell at a glyph; the font has 16 glyphs of 8x24 pixels to a row.
+
+void set_glyph(sf::Vertex *quad, uint8_t glyph) {
+  float x = (glyph % 16) * 8;
+  float y = (glyph / 16) * 24;
+  quad[0].texCoords = sf::Vector2f(x, y);
+  quad[1].texCoords = sf::Vector2f(x + 8, y);
+  quad[2].texCoords = sf::Vector2f(x + 8, y + 24);
+  quad[3].texCoords = sf::Vector2f(x, y + 24);
+}
+
+// The machine runs on a thread of its own.  At the end of each frame
+// it publishes everything the display needs through a triple buffer,
+// and key presses and function keys come back through a queue, so a
+// slow redraw never holds up the emulation.
+
+// Everything shown in the window, copied out of the machine
+
+typedef struct Frame {
+  uint8_t vdu[_1K];
+  int vdu_startrow;
+  int cursor_position;
+  uint8_t led_buffer;
+  bool tape_relay;
+  int tape_status;
+  bool paused;
+  bool halted;
+  bool turbo;
+  unsigned long long cycles;
+  unsigned int commands; // the number of commands acted on so far
+  unsigned int row_version[16]; // changes whenever a row of vdu changes
+} Frame;
+
+typedef enum {KEY_DOWN, KEY_UP, INTERRUPT, RESET, EPROM_SAVE, EPROM_FAIL, EPROM_ERASE,
+	      STATUS, CORE_DUMP, PAUSE, TURBO, SAVE_STATE, LOAD_STATE, REWIND, REWIND_STOP,
+	      TAPE_NEXT, TAPE_PREVIOUS} command_t;
+
+typedef struct Command {
+  command_t type;
+  uint8_t byte; // the key, or the RST instruction for an interrupt
+} Command;
+
+// The sound.  Port 7 switches a 1 kHz oscillator on and off, and each
+// switch is passed over with the cycle count at which it happened, so
+// the square wave can be put together sample by sample against the
+// emulated clock however quickly a program switches it.  The stream
+// plays a couple of frames behind the emulation, skipping ahead if it
+// falls further behind, and going quiet if it catches up (when paused
+// say), so it neither blocks the emulation nor drifts away from it.
+// While the emulation is idle, as it is when the program is only
+// polling the keyboard, the oscillator carries on as it was.  If the
+// stream falls so far behind that the queue of switches fills up (in
+// turbo mode say) any more are dropped and counted.
+
+#define SOUND_RATE 44100
+#define SOUND_CHUNK 1024 // samples at a time
+#define TONE_PERIOD 800 // cycles, for 1 kHz
+#define TONE_AMPLITUDE 8000
+
+class ToneStream : public sf::SoundStream {
+public:
+  SpscQueue<ToneChange, 4096> changes; // from the emulation thread
+  std::atomic<unsigned long long> latest{0}; // the cycles the emulation has got to
+  std::atomic<bool> idle{false}; // running, but with nothing to do
+  unsigned long dropped = 0; // switches the queue had no room for
+  ToneStream(int cycles_per_frame) : lag(2 * cycles_per_frame), max_lag(8 * cycles_per_frame) {
+    initialize(1, SOUND_RATE);
+  }
+  ~ToneStream() { stop(); } // the stream thread calls onGetData until it is stopped
+  void push(const ToneChange &change) { if (!changes.push(change)) dropped++; }
+private:
+  const unsigned long long lag, max_lag;
+  const double step = 800000.0 / SOUND_RATE; // cycles per sample
+  double cursor = 0.0; // the cycles the sound has got to
+  double held = 0.0; // and how far past that while the emulation is idle
+  bool on = false;
+  bool have_next = false;
+  ToneChange next;
+  sf::Int16 samples[SOUND_CHUNK];
+  bool next_due(double cycles);
+  void follow(double cycles);
+  bool onGetData(Chunk &data) override;
+  void onSeek(sf::Time offset) override {}
+};
+
+// Whether the next switch of the oscillator has come by this point
+
+bool ToneStream::next_due(double cycles) {
+  if (!have_next) have_next = changes.pop(next);
+  return have_next && (next.restart || next.cycles <= cycles);
+}
+
+// Switch the oscillator as the emulation did, up to this point
+
+void ToneStream::follow(double cycles) {
+  while (next_due(cycles)) {
+    on = next.on;
+    if (next.restart) cursor = next.cycles;
+    have_next = false;
   }
 }
 
-// Ports 0xfc to 0xff belong to the Intel 8255 in the EPROM programmer.
-// The implementation is not a generic 8255 emulation however.
+// The oscillator, running all the time whether it is heard or not
 
-void MachineInOut(State8080 *state, uint8_t *memory, IOState *io,
-		  fstream &tape, StateEPROM *eprom) {
-  switch(state->port) {
-  case 0: // Keyboard buffer (IC 49)
-    state->a = io->key_buffer;
-    break;
-  case 1: // Get UART status
-    state->a = io->uart_status;
-    break;
-  case 2: // Output data to tape
-    if (io->tape_relay) {
-      if (io->tape_status == ' ') {
-	if (tape_file != NULL) {
-	  tape.open(tape_file, ios::out | ios::app | ios::binary);
-	  if (tape.is_open()) io->tape_status = 'w';
-	  else { // failed to open file for writing
-	    io->tape_relay = false;
-	    fprintf(stderr, "Tape interface: unable to open %s for writing\n", tape_file);
-	  }
-	} // tape_file was NULL - dump bytes
-      }
-      if (io->tape_status == 'w') {
-	char c;
-	c = (char)state->a;
-	tape.put(c);
-      }
+static sf::Int16 square(double cycles) {
+  return (unsigned long long)cycles % TONE_PERIOD < TONE_PERIOD / 2 ? TONE_AMPLITUDE : -TONE_AMPLITUDE;
+}
+
+bool ToneStream::onGetData(Chunk &data) {
+  unsigned long long end = latest.load();
+  int i;
+  if (end > max_lag && cursor + max_lag < end) { // fallen behind, so catch up
+    cursor = end - lag;
+    follow(cursor);
+  }
+  for (i=0; i<SOUND_CHUNK; i++) {
+    follow(cursor);
+    if (cursor + step > latest.load()) { // caught up with the emulation
+      samples[i] = (on && idle.load()) ? square(cursor + held) : 0;
+      held += step;
+      continue;
     }
+    samples[i] = on ? square(cursor) : 0;
+    cursor += step;
+    held = 0.0;
+  }
+  data.samples = samples;
+  data.sampleCount = SOUND_CHUNK;
+  return true;
+}
+
+typedef struct Emulation {
+  TritonMachine *machine;
+  History *history; // NULL if there is no rewind
+  ToneStream *tone;
+  vector<ToneChange> tone_changes; // in the last run
+  const char *state_file;
+  int framerate;
+  int ops_per_frame;
+  bool pause = false; // these belong to the emulation thread once it has started
+  bool turbo = false;
+  bool rewinding = false;
+  unsigned int commands = 0;
+  unsigned int row_version[16] = {};
+  TripleBuffer<Frame> frames;
+  SpscQueue<Command, 256> queue;
+  std::atomic<bool> running{true};
+} Emulation;
+
+// Pass a command to the emulation thread, returning false if the
+// queue is full and the command has been dropped
+
+bool send_command(Emulation *emu, command_t type, uint8_t byte = 0) {
+  Command command = {type, byte};
+  return emu->queue.push(command);
+}
+
+// The input log only makes sense if the machine is never put back into
+// another state, so stop recording if it is
+
+void stop_recording(TritonMachine *machine) {
+  if (machine->recording) fprintf(stderr, "Input log: recording stopped as the state has been changed\n");
+  machine->recording = NULL;
+}
+
+// Act on a command from the display thread
+
+void execute_command(Emulation *emu, const Command &command) {
+  TritonMachine *machine = emu->machine;
+  StateEPROM *eprom = &machine->eprom;
+  fstream fs;
+  int i;
+  switch (command.type) {
+  case KEY_DOWN: machine->key_press(command.byte, true); break;
+  case KEY_UP: machine->key_press(command.byte, false); break;
+  case INTERRUPT: machine->interrupt(command.byte); break;
+  case RESET: machine->reset(); break;
+  case EPROM_SAVE: // save EPROM to file
+    if (eprom->file != NULL) {
+      fs.open(eprom->file, ios::out | ios::binary);
+      if (fs.is_open()) {
+	fs.write((char *)eprom->rom, _1K);
+	fs.close();
+	fprintf(stderr, "EPROM programmer: saved EPROM to %s\n", eprom->file);
+	if (check_write_counts(eprom)) {
+	  fprintf(stderr, "EPROM programmer: one or more write counts < 100\n");
+	}
+      } else fprintf(stderr, "EPROM programmer: file %s could not be opened for writing\n", eprom->file);
+    } else fprintf(stderr, "EPROM programmer: no file specified (-z missing)\n");
     break;
-  case 3: // LED buffer (IC 50)
-    io->led_buffer = state->a;
+  case EPROM_FAIL: // toggle simulate READ ERROR failure
+    eprom->failed = !eprom->failed;
+    if (!eprom->failed) fprintf(stderr, "EPROM programmer: failure mode turned OFF\n");
+    else fprintf(stderr, "EPROM programmer: failure mode turned ON, no data will be written\n");
     break;
-  case 4: // Input data from tape
-    if (io->tape_relay) {
-      if (io->tape_status == ' ') {
-	if (tape_file != NULL) {
-	  tape.open(tape_file, ios::in | ios::binary);
-	  if (tape.is_open()) io->tape_status = 'r';
-	  else {
-	    io->tape_relay = false;
-	    fprintf(stderr, "Unable to open tape file %s for reading\n", tape_file);
-	  }
-	} // Tape file was NULL - return 0xff as below
-      }
-      if ((io->tape_status == 'r') && (tape.eof() == false)) {
-	char c;
-	tape.get(c);
-	state->a = (uint8_t)c;
-      } else {
-	state->a = 0xff; // return 0xff as bad data
-      }
-    }
+  case EPROM_ERASE:
+    UV_erase(eprom);
+    fprintf(stderr, "EPROM programmer: UV erased EPROM\n");
     break;
-  case 5: // VDU buffer (IC 51)
-    if (io->vdu_buffer != state->a) {
-      io->vdu_buffer = state->a;
-      if (state->a >= 0x80) io->vdu_strobe(state, memory);
-    }
+  case STATUS:
+    WriteStatus8080(stderr, &machine->state); fprintf(stderr, "\n");
     break;
-  case 6: // port 6 latches (IC 52) -- printer emulation
-    uint8_t byte;
-    byte = state->a & 0x80; // keep only bit 8 of the output
-    if (io->port6_bit_count == 0) {
-      if (byte == 0x80) { // start bit
-	io->print_byte = 0x00; // keep track of bit-banged output
-	io->port6_bit_count = 1;
-      }
-    } else {
-      if (io->port6_bit_count < 9) { // seven data bits, with eighth (fake parity) bit always set
-	io->print_byte = (io->print_byte >> 1) | byte;
-	io->port6_bit_count++;
-      } else { // stop bit - process captured output to ASCII character
-	byte = ~io->print_byte; // complement; fake parity bit is now unset
-	printf("%c", (char)byte); // this is now an ASCII character and can be printed
-	io->port6_bit_count = 0; // reset counter and look out for next start bit
-      }
+  case CORE_DUMP:
+    fs.open(core_dump, ios::out | ios::binary);
+    if (fs.is_open()) {
+      fs.write((char *)machine->memory, _64K);
+      fs.close();
+      fprintf(stderr, "core dump: saved memory to '%s'\n", core_dump);
     }
     break;
-  case 7: // port 7 latches (IC 52) and tape power switch (RLY 1)
-    io->oscillator = ((state->a & 0x40) != 0);
-    if (((state->a & 0x80) != 0) && (io->tape_relay == false)) io->tape_relay = true;
-    if (((state->a & 0x80) == 0) && io->tape_relay) {
-      if ((io->tape_status == 'w') || (io->tape_status == 'r')) {
-	tape.close();
-	io->tape_status = ' ';
-      }
-      io->tape_relay = false;
-    }
+  case PAUSE:
+    emu->pause = !emu->pause;
+    if (!emu->pause) fprintf(stderr, "Emulation resumed\n");
+    else fprintf(stderr, "Emulation paused - press F5 to resume, or ctrl + shift + F9 to exit\n");
     break;
-  case 0xfc: // 8255 port A (IN or OUT selected by control word - see below)
-    if (state->port_op == 0xd3 && eprom->portA_dirn == OUTPUT) eprom->a = state->a; // output
-    else { // input if port A direction is IN, EPROM CS is enabled, and there is a ROM loaded
-      if (eprom->portA_dirn == INPUT && eprom->chip_select && eprom->rom != NULL) {
-	uint8_t upper = eprom->c & 0x03; // the least two bits of C are the top two bits of the address
-	uint16_t address = ((upper << 8) | (eprom->b)) & 0x03ff; // form the full address from these and B
-	eprom->a = eprom->rom[address]; // read from ROM
-      } else eprom->a = 0xff; // failed to meet test to read from ROM, return 0xff
-      state->a = eprom->a;
-    }
+  case TURBO:
+    emu->turbo = !emu->turbo;
+    if (emu->turbo) fprintf(stderr, "Turbo mode on\n");
+    else fprintf(stderr, "Turbo mode off\n");
     break;
-  case 0xfd: // 8255 port B (always OUT)
-    if (state->port_op == 0xd3) eprom->b = state->a;
+  case SAVE_STATE:
+    if (machine->save_state(emu->state_file)) fprintf(stderr, "Saved state to %s\n", emu->state_file);
     break;
-  case 0xfe: // 8255 port C (lower 4 bits always OUT; upper 4 bits always IN)
-    if (state->port_op == 0xd3) { // output
-      eprom->c = (eprom->c & 0xf0) | (state->a & 0x0f); // latch only lower 4 bits
-      eprom->chip_select = ((eprom->c & 0x0c) == 0x04); // implement the hardware logic that..
-      eprom->write_enable = ((eprom->c & 0x0c) == 0x08); // connects C bits 2, 3 to 2708 CS/WE
-      // write to EPROM if port A direction is OUT, the EPROM is write-enabled, and there is a EPROM loaded
-      if (eprom->portA_dirn == OUTPUT && eprom->write_enable && eprom->rom != NULL) {
-	uint8_t upper = eprom->c & 0x03; // the least two bits of C are the top two bits of the address
-	uint16_t address = ((upper << 8) | (eprom->b)) & 0x03ff; // form the full address from these and B
-	if (!eprom->failed) eprom->rom[address] &= eprom->a; // can only _unset_ bits, 1 --> 0, hence '&='
-	eprom->write_count[address]++; // increment the write count for that memory location
-	eprom->c &= 0xef; // clear the high bit in C to show successful write sequence
-      }
-    } else { // input
-      state->a = (eprom->c & 0xf0) & 0x0f; // just read the upper 4 bits
+  case LOAD_STATE:
+    if (machine->load_state(emu->state_file)) {
+      fprintf(stderr, "Restored state from %s\n", emu->state_file);
+      if (emu->history) emu->history->clear();
+      stop_recording(machine);
     }
     break;
-  case 0xff: // 8255 control word; bit 4 (& 0x10) sets the direction of port A
-    if (state->port_op == 0xd3) {
-      eprom->ctl = state->a;
-      eprom->portA_dirn = (eprom->ctl & 0x10) == 0x00 ? OUTPUT : INPUT;
+  case REWIND: // step back once if paused, otherwise keep going back until the key is released
+    if (emu->history == NULL) fprintf(stderr, "Rewind is turned off (-R 0)\n");
+    else {
+      stop_recording(machine);
+      if (!emu->pause) emu->rewinding = true;
+      else if (!emu->history->step_back(machine)) fprintf(stderr, "Rewind: no more history\n");
     }
     break;
-  }
-  //  if (state->port > 0xfb) {
-  //    printf("8255: %02X ", state->a);
-  //    if (state->port_op == 0xd3) printf("-->");
-  //    else printf("<--");
-  //    switch (state->port) {
-  //    case 0xfc: printf(" port A/FC"); break;
-  //    case 0xfd: printf(" port B/FD"); break;
-  //    case 0xfe: printf(" port C/FE"); break;
-  //    case 0xff: printf(" ctrl  /FF"); break;
-  //    }
-  //    printf(" | "); WriteStatusEPROM(stdout, eprom);
-  //    printf(" | "); WriteStatus8080(stdout, state); printf("\n");
-  //  }
-  state->port_op = 0x00;
-}
-
-void load_rom(uint8_t *memory, const char *rom_name, uint16_t rom_start, uint16_t rom_size) {
-  ifstream rom;
-  rom.open(rom_name, ios::in | ios::binary);
-  if (rom.is_open()) {
-    rom.read((char *) &memory[rom_start], rom_size);
-    rom.close();
-    fprintf(stderr, "%04X-%04X: %s loaded\n", rom_start, rom_start+rom_size-1, rom_name);
+  case REWIND_STOP:
+    emu->rewinding = false;
+    break;
+  case TAPE_NEXT: // wind the tape to a program
+  case TAPE_PREVIOUS:
+    i = machine->step_tape(command.type == TAPE_NEXT);
+    if (i == 0) fprintf(stderr, "Tape: no programs found\n");
+    else fprintf(stderr, "Tape: wound to program %i, %s\n", i, machine->tape_index[i-1].name.c_str());
+    break;
   }
 }
 
-// Set all bytes to 0xff and (re)initialise write counts.
-
-void UV_erase(StateEPROM *eprom) {
-  int i;
-  for (i=0; i<_1K; i++) {
-      eprom->rom[i] = 0xff;
-      eprom->write_count[i] = 0;
+// Copy the state of the display out of the machine and hand it over.
+// Only the rows of VDU memory that are out of date in this frame (it
+// was last written two frames ago, or earlier) are copied.
+
+void publish_frame(Emulation *emu) {
+  TritonMachine *machine = emu->machine;
+  Frame *frame = emu->frames.back();
+  uint16_t rows = machine->vdu_changes();
+  int row;
+  for (row=0; row<16; row++) {
+    if (rows & (1 << row)) emu->row_version[row]++;
+    if (frame->row_version[row] != emu->row_version[row]) {
+      memcpy(frame->vdu + 64 * row, machine->memory + 0x1000 + 64 * row, 64);
+      frame->row_version[row] = emu->row_version[row];
+    }
   }
+  frame->vdu_startrow = machine->io.vdu_startrow;
+  frame->cursor_position = machine->io.cursor_position;
+  frame->led_buffer = machine->io.led_buffer;
+  frame->tape_relay = machine->io.tape_relay;
+  frame->tape_status = machine->io.tape_status;
+  frame->paused = emu->pause;
+  frame->halted = machine->state.halted;
+  frame->turbo = emu->turbo;
+  frame->cycles = machine->state.cycles;
+  frame->commands = emu->commands;
+  emu->frames.publish();
 }
 
-// Check to see if any write counts were less than 100.
-
-bool check_write_counts(StateEPROM *eprom) {
-  int i;
-  for (i=0; i<_1K; i++) {
-    if (eprom->write_count[i] < 100) return true;
+// The emulation thread.  Each frame, act on any commands, send as many
+// clock pulses to the CPU as would happen in a frame, then publish the
+// frame and sleep until the next one is due.  In turbo mode keep going
+// for as long as a frame lasts instead.  Nothing is run when paused,
+// halted or just polling the keyboard, and a frame is only published
+// when something might have changed.  A snapshot is taken for rewind
+// after each frame that runs; when rewinding, the machine steps back
+// a snapshot each frame instead.
+
+void emulate(Emulation *emu) {
+  TritonMachine *machine = emu->machine;
+  const chrono::microseconds frame_time(1000000 / emu->framerate);
+  chrono::steady_clock::time_point next = chrono::steady_clock::now();
+  chrono::steady_clock::time_point now;
+  Command command;
+  bool changed, busy;
+  unsigned long long cycles;
+  machine->tone_changes = &emu->tone_changes;
+  while (emu->running.load()) {
+    cycles = machine->state.cycles;
+    for (changed = false; emu->queue.pop(command); changed = true) {
+      execute_command(emu, command);
+      emu->commands++;
+      machine->polling = false; // run again in case this changes anything
+    }
+    if (emu->rewinding && !emu->pause) {
+      busy = false;
+      if (emu->history->step_back(machine)) changed = true;
+    } else busy = !emu->pause && !machine->state.halted && !machine->polling;
+    if (machine->state.cycles != cycles) { // restored or rewound
+      emu->tone->push({machine->state.cycles, machine->io.oscillator, true});
+    }
+    if (busy) {
+      if (emu->turbo) {
+	chrono::steady_clock::time_point end = chrono::steady_clock::now() + frame_time;
+	while (machine->run(emu->ops_per_frame) && !machine->polling && chrono::steady_clock::now() < end);
+      } else machine->run(emu->ops_per_frame);
+      if (emu->history) emu->history->snapshot(machine);
+    }
+    for (const ToneChange &change : emu->tone_changes) emu->tone->push(change);
+    emu->tone_changes.clear();
+    emu->tone->latest = machine->state.cycles;
+    emu->tone->idle = !busy && !emu->pause && !emu->rewinding;
+    if (busy || changed) publish_frame(emu);
+    // Keep to real time, but don't try to catch up after falling behind
+    now = chrono::steady_clock::now();
+    if (busy && emu->turbo) next = now;
+    else {
+      next += frame_time;
+      if (next < now) next = now;
+      else this_thread::sleep_until(next);
+    }
   }
-  return false;
-}
-
-// Print help about the function keys
-
-void print_help(FILE *fp) {
-  fprintf(fp, "\nFunction Keys -- whilst emulation running\n\n");
-  fprintf(fp, "F1: interrupt 1 (RST 1) - clear screen\n");
-  fprintf(fp, "F2: interrupt 2 (RST 2) - save and dump registers\n");
-  fprintf(fp, "F3: reset (RST 0)\n\n");
-  fprintf(fp, "F4: write the EPROM to the file specified by -z\n");
-  fprintf(fp, "shift + F4: toggle simulation of READ ERROR failure mode\n");
-  fprintf(fp, "ctrl + shift + F4: UV erase the EPROM (set all bytes to 0xff)\n\n");
-  fprintf(fp, "F5: toggle emulator pause\n");
-  fprintf(fp, "shift + F5: write 8080 status to command line\n");
-  fprintf(fp, "ctrl + shift + F5: dump core\n\n");
-  fprintf(fp, "F9: print help about the function keys\n");
-  fprintf(fp, "ctrl + shift + F9: exit emulator\n");
 }
 
 int main(int argc, char** argv) {
-  uint8_t main_memory[_64K];
   int cursor_count = 0;
-  int i;
-  IOState io;
+  int i, row;
   int xpos, ypos;
   uint8_t mask, byte;
   int framerate = 25;
-  int ops, ops_per_frame;
+  int rewind_mb = 8;
+  int ops_per_frame;
   int glyph;
   int vdu_rolloffset;
   bool inFocus = true;
   bool shifted = false;
   bool ctrl = false;
-  bool pause = false;
+  bool turbo = false;
+  bool fast_tape = false;
+  bool fast_print = false;
+  int tape_program = 0;
   bool cursor_on = true;
   char *mem_top_opt = NULL;
+  uint16_t mem_top;
+  char *tape_file = NULL;
+  char *user_rom = NULL;
+  char *eprom_file = NULL;
+  const char *state_file = NULL;
+  char *profile_file = NULL;
+  char *record_file = NULL;
+  char *printer_file = NULL;
+  InputLog record_log;
+  char *symbol_files = NULL;
+  SymbolTable symbols;
   char *pend;
   int c;
 
-  fstream tape;
-
-  State8080 state;
-  StateEPROM eprom;
-
   // Shut GetOpt error messages down (return '?'):
   // From the docs: You don’t ordinarily need to copy the optarg
   // string, since it is a pointer into the original argv array, not
   // into a static area that might be overwritten.
 
   opterr = 0;
-  while ((c = getopt(argc, argv, "hm:u:z:")) != -1) switch (c) {
+  while ((c = getopt(argc, argv, "hl:m:o:qs:tu:z:FI:P:R:T:")) != -1) switch (c) {
+    case 'l': state_file = optarg; break;
     case 'm': mem_top_opt = optarg; break;
+    case 'o': printer_file = optarg; break;
+    case 'q': fast_print = true; break;
+    case 's': symbol_files = optarg; break;
+    case 't': turbo = true; break;
     case 'u': user_rom = optarg; break;
-    case 'z': eprom.file = optarg; break;
+    case 'z': eprom_file = optarg; break;
+    case 'F': fast_tape = true; break;
+    case 'I': record_file = optarg; break;
+    case 'P': profile_file = optarg; break;
+    case 'R': rewind_mb = strtoul(optarg, &pend, 0); break;
+    case 'T': tape_program = strtoul(optarg, &pend, 0); break;
     case 'h': case '?':
       printf("SFML-based Triton emulator\n");
-      printf("usage: %s [-h|-?] [-m mem_top] [-u user_rom(s)] [-z user_eprom] [tape_file]\n", argv[0]);
+      printf("usage: %s [-h|-?] [-l state_file] [-m mem_top] [-o printer_file] [-q] [-s symbol_file(s)] [-t] [-u user_rom(s)] [-z user_eprom] [-F] [-I input_log] [-P profile_file] [-R megabytes] [-T program] [tape_file]\n", argv[0]);
       printf("-h or -? (help) : print this help\n");
-      printf("-m sets the top of memory, for example -m 0x4000, defaults to 0x2000\n");
+      printf("-l restores the machine from state_file if it exists, and sets the file for F7\n");
+      printf("-m sets the top of memory, a multiple of 0x100 from 0x1400 to 0xff00, for example -m 0x4000, defaults to 0x2000\n");
+      printf("-o sends the printer output to printer_file, or to a command with |command, instead of stdout\n");
+      printf("-q prints each character in one go, instead of bit banging it through the monitor\n");
+      printf("-s reads symbols for the profile from variable lists printed by trimcc -v, separated by commas\n");
+      printf("-t starts in turbo mode (F6)\n");
       printf("-u installs user ROM(s); to install two ROMS separate the filenames by a comma\n");
       printf("-z specifies a file to write the EPROM to, with F4\n");
+      printf("-F loads programs from tape in one go, instead of a byte at a time through the monitor\n");
+      printf("-I records the input (keys, interrupts, resets and tape reads) to input_log, for triton-headless -i\n");
+      printf("-P profiles the emulation, writing a report to profile_file on exit\n");
+      printf("-R sets the memory kept for rewinding (F8) in megabytes, defaults to 8, 0 turns rewind off\n");
+      printf("-T winds the tape to the start of a program, numbered from 1 (F10)\n");
       print_help(stdout);
     default:
       exit(0);
@@ -488,54 +569,39 @@ int main(int argc, char** argv) {
 
   ops_per_frame = 800000 / framerate;
 
-  mem_top = (mem_top_opt == NULL) ? mem_top_default : strtoul(mem_top_opt, &pend, 0);
-
-  sf::Int16 wave[11025]; // Quarter of a second at 44.1kHz
+  mem_top = MEM_TOP_DEFAULT;
+  if (mem_top_opt != NULL && !parse_mem_top(mem_top_opt, mem_top)) exit(1);
 
-  const double increment = 1000./44100;
-  double x = 0;
-
-  for (i=0; i<11025; i++) {
-    wave[i] = 10000 * sin(x * 6.28318);
-    x += increment;
-  }
+  // Set up the machine then load ROMs
 
-  sf::SoundBuffer Buffer;
-  Buffer.loadFromSamples(wave, 11025, 1, 44100);
-  sf::Sound beep;
-  beep.setBuffer(Buffer);
-  beep.setLoop(true);
+  TritonMachine machine(mem_top);
+  StateEPROM &eprom = machine.eprom;
 
-  io.vdu_startrow = 0;
+  eprom.file = eprom_file;
+  machine.load_roms(user_rom);
 
-  io.uart_status = 0x11;
-  io.tape_status = ' ';
+  // Skip booting if there is a saved state to start from, but a tape
+  // file given on the command line wins over the one in the state
 
-  io.print_byte = 0x00;
-  io.port6_bit_count = 0;
-
-  // Initialise memory to 0xFF then load ROMs
-
-  for (i=0; i<_64K; i++) main_memory[i] = 0xff;
-
-  load_rom(main_memory, "mona72.bin",  0x0000, _1K);
-  load_rom(main_memory, "monb72.bin",  0x0c00, _1K);
-  load_rom(main_memory, "trap.bin",    0xc000, _8K);
-  load_rom(main_memory, "basic72.bin", 0xe000, _8K);
-
-  if (user_rom != NULL) {
-    if (char *s = strchr(user_rom, ',')) { // check for a comma
-      s[0] = '\0'; // if found, truncate the user_rom string at the comma
-      load_rom(main_memory, ++s, 0x0800, _1K); // use the remainder to load the second user ROM
-    }
-    load_rom(main_memory, user_rom, 0x0400, _1K); // load the first user ROM
+  if (state_file == NULL) state_file = state_file_default;
+  else if (access(state_file, F_OK) == 0 && !machine.load_state(state_file)) exit(1);
+  if (tape_file != NULL) machine.tape_file = tape_file;
+  if (tape_program != 0 && !machine.seek_tape(tape_program)) {
+    fprintf(stderr, "Tape: no program %i on the tape, which has\n", tape_program);
+    write_tape_index(stderr, machine.tape_index);
+    exit(1);
   }
+  machine.detect_polling = true;
+  machine.fast_tape = fast_tape;
+  machine.fast_print = fast_print;
+  if (printer_file != NULL && !machine.printer.open(printer_file)) {
+    fprintf(stderr, "Unable to open %s for the printer\n", printer_file);
+    exit(1);
+  }
+  if (record_file != NULL) machine.recording = &record_log;
 
-  UV_erase(&eprom);
-
-  if (eprom.file != NULL) load_rom(eprom.rom, eprom.file, 0x0000, _1K);
-
-  Reset8080(&state);
+  if (symbol_files != NULL && !load_symbols(symbol_files, symbols)) exit(1);
+  if (profile_file != NULL) EnableProfile8080(&machine.state, true);
 
   // Initialise window
 
@@ -551,17 +617,20 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Error loading tape image\n");
     exit(1);
   }
-  sf::Sprite sprite[1024];
+  sf::VertexArray screen(sf::Quads, 4 * 1024);
   sf::CircleShape led[8];
   sf::Color ledoff = sf::Color(100,0,0);
   sf::Color ledon = sf::Color(250,0,0);
   sf::Sprite tape_indicator;
   sf::RectangleShape cursor(sf::Vector2f(8.0f, 2.0f));
   for (i=0; i<1024; i++) {
-    sprite[i].setTexture(fontmap);
+    sf::Vertex *quad = &screen[4 * i];
     ypos = ((i - (i % 8)) / 64) * 24;
     xpos = (i % 64) * 8;
-    sprite[i].setPosition(sf::Vector2f((float) xpos,(float) ypos));
+    quad[0].position = sf::Vector2f((float) xpos, (float) ypos);
+    quad[1].position = sf::Vector2f((float) xpos + 8, (float) ypos);
+    quad[2].position = sf::Vector2f((float) xpos + 8, (float) ypos + 24);
+    quad[3].position = sf::Vector2f((float) xpos, (float) ypos + 24);
   }
   for (i=0; i<8; i++) {
     led[i].setRadius(7.0f);
@@ -570,9 +639,58 @@ int main(int argc, char** argv) {
   tape_indicator.setTexture(tapemap);
   tape_indicator.setPosition(sf::Vector2f(462.0f, 386.0f));
 
+  // In turbo mode the speed, as a multiple of the real Triton, is
+  // measured every second and shown in the status bar
+
+  const sf::Time frame_time = sf::seconds(1.0f / framerate);
+  sf::Clock speed_clock;
+  unsigned long long speed_cycles = 0;
+  bool speed_shown = false;
+  char speed_text[16] = "";
+  sf::Sprite speed_sprite[sizeof(speed_text)];
+  for (i=0; i<(int)sizeof(speed_text); i++) {
+    speed_sprite[i].setTexture(fontmap);
+    speed_sprite[i].setPosition(sf::Vector2f(200.0f + 8 * i, 387.0f));
+  }
+
+  // Start the machine running on its own thread
+
+  Emulation emu;
+  emu.machine = &machine;
+  emu.state_file = state_file;
+  History history((size_t)rewind_mb << 20);
+  emu.history = (rewind_mb > 0) ? &history : NULL;
+  emu.framerate = framerate;
+  emu.ops_per_frame = ops_per_frame;
+  emu.turbo = turbo;
+  ToneStream tone(ops_per_frame);
+  emu.tone = &tone;
+  tone.play();
+  thread emulation(emulate, &emu);
+  const Frame *frame = emu.frames.front();
+  unsigned int sent = 0; // commands sent to the emulation thread
+
+  // What is on the screen, to decide whether it needs redrawing
+
+  unsigned int drawn_version[16] = {};
+  int drawn_startrow = -1;
+  int drawn_cursor = -1;
+  int drawn_leds = -1;
+  int drawn_tape = -1;
+  bool redraw;
+
   while (window.isOpen()) {
     sf::Event event;
-    while (window.pollEvent(event)) {
+    bool have_event;
+
+    // Rather than spin, block until there is an event when paused or
+    // halted (an interrupt or a reset ends a halt), as long as the
+    // emulation has caught up with the commands sent to it
+
+    if ((frame->paused || frame->halted) && frame->commands == sent) have_event = window.waitEvent(event);
+    else have_event = window.pollEvent(event);
+
+    for (redraw = have_event; have_event; have_event = window.pollEvent(event)) {
       // Close application on request
       if (event.type == sf::Event::Closed) window.close();
       // Don't react to keyboard input when not in focus
@@ -591,131 +709,165 @@ int main(int argc, char** argv) {
         if (event.type == sf::Event::KeyPressed) {
           switch(event.key.code) {
 	  case sf::Keyboard::F1: // jam RST 1 instruction (clear screen)
-	    state.interrupt = 0xcf;
+	    sent += send_command(&emu, INTERRUPT, 0xcf);
 	    break;
 	  case sf::Keyboard::F2: // jam RST 2 instruction (print registers and flags)
-	    state.interrupt = 0xd7;
+	    sent += send_command(&emu, INTERRUPT, 0xd7);
 	    break;
 	  case sf::Keyboard::F3: // Perform a hardware reset
-	    Reset8080(&state);
+	    sent += send_command(&emu, RESET);
 	    break;
 	  case sf::Keyboard::F4: // EPROM programmer functions
 	    if (shifted) {
-	      if (ctrl) { // ctrl + shift = UV erase EPROM
-		UV_erase(&eprom);
-		fprintf(stderr, "EPROM programmer: UV erased EPROM\n");
-	      } else { // shift = toggle simulate READ ERROR failure
-		eprom.failed = !eprom.failed;
-		if (!eprom.failed) fprintf(stderr, "EPROM programmer: failure mode turned OFF\n");
-		else fprintf(stderr, "EPROM programmer: failure mode turned ON, no data will be written\n");
-	      }
-	    } else { // save EPROM to file
-	      if (eprom.file != NULL) {
- 		fstream fs;
-		fs.open(eprom.file, ios::out | ios::binary);
-		if (fs.is_open()) {
-		  fs.write((char *)eprom.rom, _1K);
-		  fs.close();
-		  fprintf(stderr, "EPROM programmer: saved EPROM to %s\n", eprom.file);
-		  if (check_write_counts(&eprom)) {
-		    fprintf(stderr, "EPROM programmer: one or more write counts < 100\n");
-		  }
-		} else fprintf(stderr, "EPROM programmer: file %s could not be opened for writing\n", eprom.file);
-	      } else fprintf(stderr, "EPROM programmer: no file specified (-z missing)\n");
-	    }
+	      if (ctrl) sent += send_command(&emu, EPROM_ERASE); // ctrl + shift = UV erase EPROM
+	      else sent += send_command(&emu, EPROM_FAIL); // shift = toggle simulate READ ERROR failure
+	    } else sent += send_command(&emu, EPROM_SAVE); // save EPROM to file
 	    break;
 	  case sf::Keyboard::F5: // Debugging functions
 	    if (shifted) {
-	      if (ctrl) { // ctrl + shift = core dump
-		fstream fs;
-		fs.open(core_dump, ios::out | ios::binary);
-		if (fs.is_open()) {
-		  fs.write((char *)main_memory, _64K);
-		  fs.close();
-		  fprintf(stderr, "core dump: saved memory to '%s'\n", core_dump);
-		}
-	      } else { // shift = write status of 8080
-		WriteStatus8080(stderr, &state); fprintf(stderr, "\n");
-	      }
-	    } else { // toggle emulator pause
-	      pause = !pause;
-	      if (!pause) fprintf(stderr, "Emulation resumed\n");
-	      else fprintf(stderr, "Emulation paused - press F5 to resume, or ctrl + shift + F9 to exit\n");
-	    }
+	      if (ctrl) sent += send_command(&emu, CORE_DUMP); // ctrl + shift = core dump
+	      else sent += send_command(&emu, STATUS); // shift = write status of 8080
+	    } else sent += send_command(&emu, PAUSE); // toggle emulator pause
+	    break;
+	  case sf::Keyboard::F6: // toggle turbo mode
+	    sent += send_command(&emu, TURBO);
+	    break;
+	  case sf::Keyboard::F7: // save or restore the state of the machine
+	    if (!shifted && !ctrl) sent += send_command(&emu, SAVE_STATE);
+	    if (shifted && !ctrl) sent += send_command(&emu, LOAD_STATE);
+	    break;
+	  case sf::Keyboard::F8: // rewind
+	    sent += send_command(&emu, REWIND);
 	    break;
 	  case sf::Keyboard::F9: // Exit emulator
 	    if (shifted && ctrl) window.close();
 	    if  (!shifted && !ctrl) print_help(stderr);
 	    break;
+	  case sf::Keyboard::F10: // wind the tape
+	    sent += send_command(&emu, shifted ? TAPE_PREVIOUS : TAPE_NEXT);
+	    break;
 	  default:
-	    io.key_press(event.type, event.key.code, shifted, ctrl);
+	    byte = key_code(event.key.code, shifted, ctrl);
+	    if (byte != 0xFF) sent += send_command(&emu, KEY_DOWN, byte); // check if the key press was recognised
 	    break;
 	  }
 	}
 	if (event.type == sf::Event::KeyReleased) {
-	  io.key_press(event.type, event.key.code, shifted, ctrl);
+	  if (event.key.code == sf::Keyboard::F8) sent += send_command(&emu, REWIND_STOP);
+	  byte = key_code(event.key.code, shifted, ctrl);
+	  if (byte != 0xFF) sent += send_command(&emu, KEY_UP, byte);
 	}
       }
     }
 
-    if (pause) beep.pause();
-    else {
-      // Send as many clock pulses to the CPU as would happen between screen frames
-      for (ops = 0; ops < ops_per_frame; ops += SingleStep8080(&state, main_memory)) {
-	if (state.halted) break;
-	if (state.port_op) MachineInOut(&state, main_memory, &io, tape, &eprom);
-      }
-      cursor_count++;
-      // Draw screen from VDU memory - font texture acts as ROMs (IC 69 and 70)
-      window.clear();
-      vdu_rolloffset = 64 * io.vdu_startrow;
-      for (i=0; i<1024; i++) {
-        glyph = main_memory[0x1000 + ((vdu_rolloffset + i) % 1024)] & 0x7f;
-        xpos = (glyph % 16) * 8;
-        ypos = ((glyph / 16) * 24);
-        sprite[i].setTextureRect(sf::IntRect(xpos, ypos, 8, 24));
-        window.draw(sprite[i]);
-      }
-      for (i=0, mask=0x80; i<8; i++) {
-	byte = io.led_buffer & mask; mask = mask >> 1;
-	led[i].setFillColor(byte == 0x00 ? ledon : ledoff); // note LEDs are on for "0"
-        window.draw(led[i]);
+    // Pick up the latest frame, and point the quads at the glyphs for
+    // the rows of VDU memory that have changed, or for every row if the
+    // screen has rolled.  Screen row r shows memory row r + vdu_startrow.
+
+    if (emu.frames.update()) {
+      frame = emu.frames.front();
+      for (row=0; row<16; row++) {
+	if (frame->vdu_startrow == drawn_startrow && frame->row_version[row] == drawn_version[row]) continue;
+	vdu_rolloffset = 64 * ((row + 16 - frame->vdu_startrow) % 16); // where the row is on screen
+	for (i=0; i<64; i++) {
+	  glyph = frame->vdu[64 * row + i] & 0x7f;
+	  set_glyph(&screen[4 * (vdu_rolloffset + i)], glyph);
+	}
+	drawn_version[row] = frame->row_version[row];
+	redraw = true;
       }
-      if (io.tape_relay == false) {
-	tape_indicator.setTextureRect(sf::IntRect(0, 0, 45, 30));
+      drawn_startrow = frame->vdu_startrow;
+      if (frame->cursor_position != drawn_cursor || frame->led_buffer != drawn_leds ||
+	  (frame->tape_relay ? frame->tape_status : 0) != drawn_tape) redraw = true;
+    }
+    if (frame->turbo != speed_shown) { // turbo mode has just been toggled
+      speed_shown = frame->turbo;
+      speed_text[0] = '\0';
+      speed_clock.restart();
+      speed_cycles = frame->cycles;
+      redraw = true;
+    }
+    if (speed_shown && speed_clock.getElapsedTime() >= sf::seconds(1.0f)) {
+      snprintf(speed_text, sizeof(speed_text), "x%.1f",
+	       (frame->cycles - speed_cycles) / (800000.0 * speed_clock.restart().asSeconds()));
+      speed_cycles = frame->cycles;
+      redraw = true;
+    }
+    if (++cursor_count > (framerate / 2)) {
+      if (cursor_on) {
+	cursor.setFillColor(sf::Color(0, 0, 0));
+	cursor_on = false;
       } else {
-        switch (io.tape_status) {
-	case ' ':
-	  tape_indicator.setTextureRect(sf::IntRect(45, 0, 45, 30));
-	  break;
-	case 'r':
-	  tape_indicator.setTextureRect(sf::IntRect(90, 0, 45, 30));
-	  break;
-	case 'w':
-	  tape_indicator.setTextureRect(sf::IntRect(135, 0, 45, 30));
-	  break;
-	}
+	cursor.setFillColor(sf::Color(255, 255, 255));
+	cursor_on = true;
       }
-      window.draw(tape_indicator);
-      if (cursor_count > (framerate / 2)) {
-        if (cursor_on) {
-          cursor.setFillColor(sf::Color(0, 0, 0));
-          cursor_on = false;
-	} else {
-          cursor.setFillColor(sf::Color(255, 255, 255));
-          cursor_on = true;
-	}
-        cursor_count = 0;
+      cursor_count = 0;
+      redraw = true;
+    }
+
+    // If nothing has changed just wait for a frame, otherwise draw the
+    // screen - font texture acts as ROMs (IC 69 and 70)
+
+    if (!redraw) {
+      sf::sleep(frame_time);
+      continue;
+    }
+    window.clear();
+    window.draw(screen, &fontmap);
+    for (i=0, mask=0x80; i<8; i++) {
+      byte = frame->led_buffer & mask; mask = mask >> 1;
+      led[i].setFillColor(byte == 0x00 ? ledon : ledoff); // note LEDs are on for "0"
+      window.draw(led[i]);
+    }
+    drawn_leds = frame->led_buffer;
+    if (frame->tape_relay == false) {
+      tape_indicator.setTextureRect(sf::IntRect(0, 0, 45, 30));
+    } else {
+      switch (frame->tape_status) {
+      case ' ':
+	tape_indicator.setTextureRect(sf::IntRect(45, 0, 45, 30));
+	break;
+      case 'r':
+	tape_indicator.setTextureRect(sf::IntRect(90, 0, 45, 30));
+	break;
+      case 'w':
+	tape_indicator.setTextureRect(sf::IntRect(135, 0, 45, 30));
+	break;
+      }
+    }
+    window.draw(tape_indicator);
+    drawn_tape = frame->tape_relay ? frame->tape_status : 0;
+    if (speed_shown) {
+      for (i=0; speed_text[i]; i++) {
+	glyph = speed_text[i] & 0x7f;
+	speed_sprite[i].setTextureRect(sf::IntRect((glyph % 16) * 8, (glyph / 16) * 24, 8, 24));
+	window.draw(speed_sprite[i]);
       }
-      i = io.cursor_position;
-      ypos = (((i - (i % 8)) / 64) * 24) + 18;
-      xpos = (i % 64) * 8;
-      cursor.setPosition(sf::Vector2f((float) xpos,(float) ypos));
-      window.draw(cursor);
-      window.display();
-      // if (io.oscillator) beep.play(); else beep.pause();
-      io.oscillator ? beep.play() : beep.pause();
     }
+    i = frame->cursor_position;
+    ypos = (((i - (i % 8)) / 64) * 24) + 18;
+    xpos = (i % 64) * 8;
+    cursor.setPosition(sf::Vector2f((float) xpos,(float) ypos));
+    window.draw(cursor);
+    drawn_cursor = frame->cursor_position;
+    window.display();
   }
+
+  emu.running = false;
+  emulation.join();
+  tone.stop();
+  if (tone.dropped) fprintf(stderr, "Sound: %lu changes of the oscillator were dropped\n", tone.dropped);
+
+  if (record_file != NULL) record_log.save(record_file);
+
+  if (profile_file != NULL) {
+    FILE *fp = fopen(profile_file, "w");
+    if (fp == NULL) fprintf(stderr, "Unable to open profile file %s\n", profile_file);
+    else {
+      write_profile(fp, machine.state.profile, symbols);
+      fclose(fp);
+    }
+  }
+
   return 0;
 }
@@ -0,0 +1,118 @@
+/*
+    triton - a Transam Triton emulator
+    Copyright (C) 2020 Robin Stuart <rstuart114@gmail.com>
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the project nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+ */
+
+/* Forked from https://github.com/woo-j/triton
+ * Additional modifications:
+ * Copyright (c) 2021 Patrick B Warren (PBW) <patrickbwarren@gmail.com>.
+ */
+
+/* Convert tapes between the byte files used by the emulator (and made
+ * by trimcc) and Kansas City audio in WAV files, for example to
+ * digitise recordings of real cassettes.
+ */
+
+#include "machine.hpp"
+#include "kcs.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  bool encode = false, list = false;
+  int rate = KCS_RATE_DEFAULT;
+  char *output_file = NULL;
+  vector<uint8_t> bytes;
+  unsigned long errors = 0;
+  char *pend;
+  int c;
+
+  opterr = 0;
+  while ((c = getopt(argc, argv, "helo:r:")) != -1) switch (c) {
+    case 'e': encode = true; break;
+    case 'l': list = true; break;
+    case 'o': output_file = optarg; break;
+    case 'r': rate = strtoul(optarg, &pend, 0); break;
+    case 'h': case '?':
+      printf("Convert a tape to or from Kansas City audio\n");
+      printf("usage: %s [-h|-?] [-e] [-l] [-o output_file] [-r rate] input_file\n", argv[0]);
+      printf("-h or -? (help) : print this help\n");
+      printf("-e encodes a tape file as a WAV file, instead of decoding a WAV file\n");
+      printf("-l lists the programs found on the tape\n");
+      printf("-o writes the tape (or WAV file with -e) to output_file\n");
+      printf("-r sets the sample rate of the WAV file with -e, defaults to %i\n", KCS_RATE_DEFAULT);
+    default:
+      exit(0);
+    }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "%s: one input file is needed, see -h\n", argv[0]);
+    exit(1);
+  }
+  if (encode && (output_file == NULL || rate < KCS_RATE_MIN)) {
+    fprintf(stderr, "%s: -e needs an output file and a sample rate of at least %i\n", argv[0], KCS_RATE_MIN);
+    exit(1);
+  }
+
+  if (encode) {
+    ifstream fs(argv[optind], ios::in | ios::binary);
+    if (!fs.is_open()) {
+      fprintf(stderr, "%s: unable to open %s\n", argv[0], argv[optind]);
+      exit(1);
+    }
+    bytes.assign(istreambuf_iterator<char>(fs), istreambuf_iterator<char>());
+    if (!write_wav(output_file, bytes, rate)) {
+      fprintf(stderr, "%s: unable to write %s\n", argv[0], output_file);
+      exit(1);
+    }
+  } else {
+    if (!read_wav(argv[optind], bytes, &errors)) {
+      fprintf(stderr, "%s: unable to read %s\n", argv[0], argv[optind]);
+      exit(1);
+    }
+    if (errors) fprintf(stderr, "%s: %lu bad bytes in %s\n", argv[0], errors, argv[optind]);
+    if (output_file != NULL) {
+      ofstream fs(output_file, ios::out | ios::binary | ios::trunc);
+      if (!fs.is_open() || !fs.write((char *)bytes.data(), bytes.size())) {
+	fprintf(stderr, "%s: unable to write %s\n", argv[0], output_file);
+	exit(1);
+      }
+    }
+  }
+
+  if (list) {
+    printf("%s: %zu bytes\n", argv[optind], bytes.size());
+    write_tape_index(stdout, index_tape(bytes));
+  }
+  return 0;
+}